@@ -3,114 +3,450 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
+#include "tag_match.h"
+
 typedef uint32_t MASK;
 typedef bool outcome;
 typedef uint32_t addr_t;
 typedef uint32_t set_t;
+typedef uint32_t tag_t;
+
+/* memory operations, encoded as they appear in the trace */
+enum op_t : char { OP_READ = 'r', OP_WRITE = 'w' };
+
+/* access_result:
+ * Everything one pass over a set finds out about an access: the way it hit
+ * in, or on a miss that allocated, the way it was put in and the line that
+ * was replaced to make room for it.
+ */
+struct access_result {
+    addr_t address;
+    tag_t tag;
+    set_t set;
+
+    outcome hit;
+    int way_nr; // = way of the hit or of the new line, -1 if neither
+
+    bool evicted; // = a valid line was replaced
+    addr_t victim_address;
+    bool victim_dirty;
+    int victim_upper_way; // = of the victim in the level above, -1 if not
+};
+
+/* which LRU bookkeeping a cache keeps, both pick the same victims */
+enum lru_kind { LRU_QUEUE, LRU_PACKED };
+
+/* which replacement policy a cache level uses */
+enum repl_kind {
+    REPL_LRU,
+    REPL_PLRU,
+    REPL_SRRIP,
+    REPL_BRRIP,
+    REPL_FIFO,
+    REPL_RANDOM
+};
+
+/* what the levels of the hierarchy keep of each other's blocks */
+enum inclusion_kind {
+    INCL_INCLUSIVE, // = a level has every block of the levels above it
+    INCL_NINE,      // = neither inclusive nor exclusive, no back invalidation
+    INCL_EXCLUSIVE  // = a block is in a single level at most
+};
+
+/* which hardware prefetcher runs, if any */
+enum prefetch_kind {
+    PREFETCH_NONE,
+    PREFETCH_NEXT_LINE,
+    PREFETCH_STRIDE,
+    PREFETCH_STREAM
+};
 
+/* cache_arena:
+ * One contiguous mapping that all the state of a cache, its tags, its
+ * replacement policy and its per way arrays, is carved out of. Its pages
+ * read as zero and are only backed once something is written to them, so
+ * the state of a cache costs as much as the sets its trace touches, not as
+ * much as its nominal size. With huge_pages the mapping is aligned for, and
+ * asks for, transparent huge pages, fewer TLB misses for big caches in
+ * exchange for backing 2 MiB at a time.
+ */
+class cache_arena {
+    static constexpr size_t ALIGNMENT = 64;
+    static constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+
+    char *mapping;
+    size_t n_of_mapped;
+    char *base; // = the mapping, aligned for huge pages if asked to
+    size_t capacity;
+    size_t n_of_used = 0;
+
+  public:
+    cache_arena(size_t _capacity, bool huge_pages);
+    ~cache_arena();
+
+    cache_arena(const cache_arena &) = delete;
+    cache_arena &operator=(const cache_arena &) = delete;
+
+    /* take:
+     * The next n_of_bytes of the arena, host line aligned and all zero.
+     */
+    void *take(size_t n_of_bytes);
+
+    /* reset:
+     * Give every page back to the kernel, so all that was taken reads as
+     * zero again, and the pages are backed again as they are written.
+     */
+    void reset();
+};
+
+/* zeroed_array:
+ * A fixed array of T taken from a cache_arena, all zero to begin with, and
+ * again after the arena is reset. Empty until allocated.
+ */
+template <class T> class zeroed_array {
+    T *items = nullptr;
+
+  public:
+    zeroed_array() {}
+    zeroed_array(cache_arena &arena, size_t n_of_items);
+
+    zeroed_array(const zeroed_array &) = delete;
+    zeroed_array &operator=(const zeroed_array &) = delete;
+
+    /* take n_of_items zeros from the arena */
+    void allocate(cache_arena &arena, size_t n_of_items);
+    bool empty() const;
+
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+};
+
+/* LRU:
+ * The LRU queue taught in class, over the queue of a single set, which its
+ * owner keeps. A queue that starts all zero is fine: only ways filled since
+ * get ages above 0, in the order they were used, so once the set is full,
+ * which is the only time a victim is asked for, it is a true LRU queue.
+ */
 class LRU {
     int assoc;
-    std::vector<uint32_t> queue;
 
   public:
     LRU(int _assoc);
 
-    int get_lru() const;
-    void update_queue(size_t index);
+    int get_lru(const uint32_t *queue) const;
+    void update_queue(uint32_t *queue, size_t index) const;
 };
 
-class tag_t {
-    uint32_t data;
-    addr_t full_address;
-    int b_tag_size;
+/* packed_lru:
+ * The same ages as the LRU queue (0 is the LRU way, assoc - 1 the MRU way),
+ * for every set of a cache, packed as one byte per way into 64 bit words.
+ * A set of up to 8 ways is a single word. Promoting a way and finding the
+ * victim work on all the ages of a word at once with SWAR arithmetic, so
+ * neither depends on the number of ways in the word. Ages need a spare top
+ * bit in their byte, which limits it to 128 ways.
+ */
+class packed_lru {
+  public:
+    static constexpr int MAX_ASSOC = 128;
+
+  private:
+    static constexpr int WAYS_PER_WORD = 8;
+    static constexpr uint64_t LOW_BITS = 0x0101010101010101ULL;
+    static constexpr uint64_t HIGH_BITS = 0x8080808080808080ULL;
 
-    bool valid;
-    bool dirty;
+    int assoc;
+    int words_per_set;
+    uint64_t last_word_lanes; // = 0xff in every lane used by the last word
+
+    zeroed_array<uint64_t> ages;
 
   public:
-    tag_t(int _b_tag_size, addr_t address = 0, uint32_t _data = 0);
-    tag_t &operator=(const tag_t &other);
+    packed_lru(cache_arena &arena, int _assoc, int _n_of_sets);
 
-    /* operator==:
-     * Very simple intager comperison.
-     */
-    bool operator==(const tag_t &other) const;
+    int get_lru(set_t set) const;
+    void update_queue(set_t set, int way_nr);
+    /* start bringing the ages of the set into the host cache */
+    void prefetch(set_t set) const;
+};
 
-    /* validate_and_insert()
-     * insert new tag and mark as valid.
-     */
-    void validate_and_insert(const tag_t &other);
+/* Replacement policies:
+ * Every policy keeps its own state for all the sets of a cache and has the
+ * same operations, which policy_cache calls directly, so picking a victim
+ * is never a virtual call:
+ *
+ *   victim(set)      - the way to replace when the set is full
+ *   touch(set, way)  - a hit (or a write back) used the way
+ *   insert(set, way) - a new block was put in the way
+ *   prefetch(set)    - the set is about to be used, start bringing its
+ *                      state into the host cache
+ *   reset()          - back to as built, once the arena has been reset
+ *
+ * They are all built from (arena, assoc, n_of_sets, seed), the ones that
+ * don't draw random numbers ignore the seed. Their state starts all zero,
+ * in zeroed_arrays of the cache's arena, whatever that means for the
+ * policy: a victim is only asked for in a full set, and every way of it
+ * has been inserted by then.
+ */
 
-    /* get_data(), is_valid, get_full_address and is_dirty:
-     * Getters for the data, valid and dirty fields.
-     */
-    uint32_t get_data() const;
-    addr_t get_full_address() const;
-    bool is_valid() const;
-    bool is_dirty() const;
+/* true LRU, with the LRU queue of every set */
+class queue_lru_policy {
+    int assoc;
+    LRU lru;
+    zeroed_array<uint32_t> queues; // = queue of a set at set * assoc
 
-    /* set_...():
-     * Setters for the data, valid and dirty fields.
-     */
-    void set_data(uint32_t _data);
-    void set_valid(bool state);
-    void set_dirty(bool state);
+  public:
+    queue_lru_policy(cache_arena &arena, int assoc, int n_of_sets,
+                     uint32_t seed);
+
+    int victim(set_t set) const;
+    void touch(set_t set, int way_nr);
+    void insert(set_t set, int way_nr);
+    void prefetch(set_t set) const;
+    void reset();
+};
+
+/* true LRU, with the packed ages, up to packed_lru::MAX_ASSOC ways */
+class packed_lru_policy {
+    packed_lru ages;
+
+  public:
+    packed_lru_policy(cache_arena &arena, int assoc, int n_of_sets,
+                      uint32_t seed);
+
+    int victim(set_t set) const;
+    void touch(set_t set, int way_nr);
+    void insert(set_t set, int way_nr);
+    void prefetch(set_t set) const;
+    void reset();
 };
 
-class way {
+/* tree_plru_policy:
+ * Tree pseudo-LRU: a binary tree of assoc - 1 bits over the ways of a set,
+ * each pointing to the half that was used less recently. A use flips the
+ * bits on its path to point away from it, and the victim is found by
+ * following them from the root.
+ */
+class tree_plru_policy {
     int assoc;
-    int n_of_lines; // = n_of_tags
-    int b_tag_size;
-    int block_size;
+    int levels;
+    zeroed_array<uint8_t> bits; // = node i of a set at set * assoc + i, 1 based
 
-    std::vector<tag_t> tags;
+  public:
+    tree_plru_policy(cache_arena &arena, int _assoc, int n_of_sets,
+                     uint32_t seed);
+
+    int victim(set_t set) const;
+    void touch(set_t set, int way_nr);
+    void insert(set_t set, int way_nr);
+    void prefetch(set_t set) const;
+    void reset();
+};
+
+/* srrip_policy:
+ * Static re-reference interval prediction (Jaleel et al.) with 2 bit
+ * predictions: a hit predicts a near re-reference (0), a new block a long
+ * one (2), and the victim is the first way predicted distant (3), ageing
+ * the whole set until there is one.
+ */
+class srrip_policy {
+  protected:
+    static constexpr uint8_t DISTANT = 3;
+
+    int assoc;
+    zeroed_array<uint8_t> rrpv; // = prediction of every way
 
   public:
-    way(int _assoc, int _n_of_lines, int _b_tag_size, int _block_size);
+    srrip_policy(cache_arena &arena, int _assoc, int n_of_sets, uint32_t seed);
+
+    int victim(set_t set);
+    void touch(set_t set, int way_nr);
+    void insert(set_t set, int way_nr);
+    void prefetch(set_t set) const;
+    void reset();
+};
 
-    /* check_tag:
-     * Check if the tag provided and tag at the index of the set are the same
-     * and return true if yes and false if no.
+/* brrip_policy:
+ * Bimodal RRIP: as SRRIP, but new blocks are predicted distant, except for
+ * one in LONG_CHANCE that gets the long prediction. Thrashing sets keep part
+ * of their blocks this way.
+ */
+class brrip_policy : public srrip_policy {
+    static constexpr uint32_t LONG_CHANCE = 32;
+
+    uint32_t seed;
+    uint32_t random_state;
+
+  public:
+    brrip_policy(cache_arena &arena, int _assoc, int n_of_sets,
+                 uint32_t seed);
+
+    void insert(set_t set, int way_nr);
+    void reset();
+};
+
+/* FIFO: the victim is the way filled longest ago, hits don't matter */
+class fifo_policy {
+    int assoc;
+    zeroed_array<uint64_t> filled;     // = fill number of every way
+    zeroed_array<uint64_t> n_of_fills; // = fills of every set
+
+  public:
+    fifo_policy(cache_arena &arena, int _assoc, int n_of_sets, uint32_t seed);
+
+    int victim(set_t set) const;
+    void touch(set_t set, int way_nr);
+    void insert(set_t set, int way_nr);
+    void prefetch(set_t set) const;
+    void reset();
+};
+
+/* random: a victim drawn from a seeded xorshift generator, so runs repeat */
+class random_policy {
+    int assoc;
+    uint32_t seed;
+    uint32_t random_state;
+
+  public:
+    random_policy(cache_arena &arena, int _assoc, int n_of_sets, uint32_t seed);
+
+    int victim(set_t set);
+    void touch(set_t set, int way_nr);
+    void insert(set_t set, int way_nr);
+    void prefetch(set_t set) const;
+    void reset();
+};
+
+/* tag_store:
+ * Set-major directory of all the tags of a cache. Every set is one
+ * contiguous block holding the valid and dirty bitmasks of the set, for
+ * sets of MIN_SIGNED_WAYS to MAX_SIGNED_WAYS ways a presence signature, and
+ * then the tag of each way:
+ *
+ *   [valid mask][dirty mask]([signature])[tag of way 0][tag of way 1]...
+ *
+ * Sets smaller than a host line are a power of two in size, and larger
+ * ones whole host lines, so probing a set touches as few host lines as it
+ * can, instead of one per way. The store is a zeroed_array of the cache's
+ * arena, where a set that was never filled takes no memory.
+ * Only the tag bits are kept, the full address of a line is rebuilt from its
+ * tag and set by the cache. Lookups compare the probed tag against all the
+ * ways of a set at once with the vector kernel of tag_match.h.
+ */
+class tag_store {
+    static constexpr size_t HOST_LINE_SIZE = 64;
+    static constexpr int WAYS_PER_MASK = 64;
+    /* narrower sets share the line of their masks with all their tags, and
+     * the signatures of wider ones are too full to tell much */
+    static constexpr int MIN_SIGNED_WAYS = TAG_MATCH_LANES;
+    static constexpr int MAX_SIGNED_WAYS = 16;
+    /* bits set past which a signature is built again without its stale
+     * bits, half of it */
+    static constexpr int DENSE_SIGNATURE = 32;
+
+    int assoc;
+    int n_of_sets;
+    int n_of_mask_words; // = words in each of the valid and dirty masks
+    int n_of_signature_words; // = 1 if the sets have a signature, or 0
+    size_t set_stride;   // = 64 bit words from one set to the next
+
+    zeroed_array<uint64_t> blocks;
+    match_fn match_tags;
+    bool presence = false; // = the signatures are kept and consulted
+
+  private:
+    static size_t set_bytes(int assoc);
+    /* the bit of the signature of a set the tag sets */
+    static uint64_t signature_bit(tag_t tag);
+    /* build the signature of the set from its valid ways again */
+    void refresh_signature(set_t set);
+
+    uint64_t *valid_mask(set_t set) const;
+    uint64_t *dirty_mask(set_t set) const;
+    uint64_t *signature(set_t set) const;
+    tag_t *set_tags(set_t set) const;
+
+  public:
+    tag_store(cache_arena &arena, int _assoc, int _n_of_sets);
+
+    /* the bytes a store of n_of_sets sets of assoc ways takes from its
+     * arena */
+    static size_t bytes_needed(int assoc, int n_of_sets);
+
+    /* prefetch:
+     * Start bringing the set into the host cache: its first host line with
+     * the masks, and unless the signature can answer a miss on its own,
+     * the rest of its tags too.
      */
-    bool find_tag(tag_t tag, set_t set) const;
+    void prefetch(set_t set) const;
 
-    /* insert_tag:
-     * Just put the tag at the index of the set and mark the dirty and valid
-     * bits as needed.
+    /* track_presence:
+     * Keep the signature of every set: the bit of the tag of every valid
+     * way set, the bit picked by hashing the tag. A tag whose bit is clear
+     * is definitely not in the set, and the finds say so without reading
+     * the tags, the host line past the masks. Never changes what they find.
+     * The bits of replaced and invalidated tags stay set, until the
+     * signature gets dense and is built again from the valid ways. Must be
+     * called while the store is empty.
+     */
+    void track_presence();
+
+    tag_store(const tag_store &) = delete;
+    tag_store &operator=(const tag_store &) = delete;
+
+    /* find_tag:
+     * Return the way holding a valid copy of the tag in the set, or -1 if
+     * there is none.
      */
-    void insert_tag(tag_t tag, set_t set);
+    int find_tag(set_t set, tag_t tag) const;
 
-    /* check_set_valid:
-     * check if the tag in the set is valid.
+    /* find_invalid:
+     * Return the first invalid way of the set, or -1 if the set is full.
      */
-    bool check_set_valid(set_t set) const;
+    int find_invalid(set_t set) const;
 
-    /* is_set_dirty:
-     * check if the tag in the set is dirty.
+    /* find_tag_fixed and find_invalid_fixed:
+     * The same for a store of exactly WAYS ways, at most 64, known at
+     * compile time. Up to TAG_MATCH_LANES ways the compares unroll into a
+     * hit mask with no call into the kernel and no branch per way.
      */
-    bool is_set_dirty(set_t set) const;
+    template <int WAYS> int find_tag_fixed(set_t set, tag_t tag) const;
+    template <int WAYS> int find_invalid_fixed(set_t set) const;
 
-    /* set_dirt_status:
-     * setter for the dirt status.
+    /* insert_tag:
+     * Put the tag in the way of the set and mark it as valid and clean.
      */
-    void set_dirt_status(set_t set, bool status);
+    void insert_tag(set_t set, int way_nr, tag_t tag);
 
-    /* set_valid_status:
-     * setter for the vaild status.
+    /* get_tag, is_valid and is_dirty:
+     * Getters for the tag, valid and dirty state of a way in the set.
      */
-    void set_valid_status(set_t set, bool status);
+    tag_t get_tag(set_t set, int way_nr) const;
+    bool is_valid(set_t set, int way_nr) const;
+    bool is_dirty(set_t set, int way_nr) const;
 
-    /* getter for the address */
-    addr_t get_full_address(set_t set) const;
+    /* set_valid and set_dirty:
+     * Setters for the valid and dirty state of a way in the set.
+     */
+    void set_valid(set_t set, int way_nr, bool status);
+    void set_dirty(set_t set, int way_nr, bool status);
 };
 
+/* cache:
+ * One level of the hierarchy: its tag store, counters and the address
+ * arithmetic, everything but the replacement policy. The operations that
+ * consult the policy are pure virtual, and policy_cache implements them for
+ * each policy, so the per access bookkeeping of the policy inlines into them
+ * and the only indirection is the single call into the level.
+ */
 class cache {
     static constexpr int B_ADDR_SIZE = 32;
     static constexpr int B_ALIGN_SIZE = 2;
     static constexpr int B_METADATA_SIZE = 2;
 
+  protected:
     int size;       // = cache size
     int block_size; // = line size
     int cycles;
@@ -126,131 +462,570 @@ class cache {
 
     bool write_alloc;
 
-    std::vector<way> ways;
-    std::vector<LRU> LRUs;
+    cache_arena arena; // = of all that follows, sized for the geometry
+    tag_store tags;
 
     MASK tag_mask;
     MASK set_mask;
 
-  private:
+    /* for every way, 0 or the cycle a prefetch that put the block there and
+     * that no demand access used yet is done, plus 1. Empty unless a
+     * prefetcher fills this cache. */
+    zeroed_array<uint64_t> prefetch_ready;
+    /* direct mapped by block, one entry a line, 0 or 1 plus a block a
+     * prefetch evicted from here. Empty unless a prefetcher fills this
+     * cache. */
+    zeroed_array<addr_t> polluted_blocks;
+    /* for every way, 0 or 1 plus the way the level above holds its block
+     * in. Empty unless this cache is below another one in an inclusive
+     * hierarchy. The way above may have been refilled since, it holds the
+     * block only if its tag still matches. */
+    zeroed_array<int> upper_ways;
+    /* for every way, 1 if another core's L1 may hold its block too, the S
+     * of MESI. Empty unless this is the L1 of a core among several. */
+    zeroed_array<uint8_t> shared_ways;
+
+  protected:
     /* create_tag and create_set:
      * Create a tag and set from the address using the mask, to send forward to
-     * the way and tag class for comperison and processing.
+     * the tag store for comperison and processing.
      */
     tag_t create_tag(addr_t address) const;
     set_t create_set(addr_t address) const;
+    /* rebuild the address of a block from its tag and set */
+    addr_t create_address(tag_t tag, set_t set) const;
     /* find empty space to insert into */
     int find_empty_space(set_t set) const;
-    /* find the lru way with the queue */
-    int get_lru_way(set_t set) const;
+    /* a probe of the address before its set is searched, a miss */
+    access_result start_probe(addr_t address) const;
+    /* the way is losing its block, and with it any prefetch mark and way
+     * above */
+    void forget_line(set_t set, int way_nr);
+
+    /* count_lookup:
+     * Count a lookup that probe found or missed, and mark the line dirty on
+     * a write hit. Return if it hit.
+     */
+    outcome count_lookup(access_result &result, op_t op);
+    /* evict:
+     * Record the line in the way as the victim of the fill of the result.
+     */
+    void evict(access_result &result, int way_nr);
+    /* place:
+     * Put the block of the result in the way, clean unless dirty.
+     */
+    void place(access_result &result, int way_nr, bool dirty);
 
   public:
     cache(int _size, int _block_size, int _cycles, int _assoc,
-          bool _write_alloc);
+          bool _write_alloc, bool huge_pages);
+    virtual ~cache();
+
+    cache(const cache &) = delete;
+    cache &operator=(const cache &) = delete;
+
+    /* lookup:
+     * Count the access and, on a hit, update the replacement state and mark
+     * the line dirty for a write. Nothing is filled on a miss, the
+     * simulator fills the block once the levels below have it.
+     */
+    virtual access_result lookup(addr_t address, op_t op) = 0;
 
-    /* find_data:
-     * Travese every way and check the tag at that way. If found matching tag,
-     * then it's a hit. If finished traversing every way and no match then it's
-     * a miss.
+    /* probe:
+     * Where the block is, if it is here, without counting an access or
+     * touching the replacement state.
      */
-    outcome find_and_read_data(addr_t address);
+    access_result probe(addr_t address) const;
 
-    /* find_victim:
-     * Check if there is empty space, if no, find a victim with LRU.
+    /* prefetch:
+     * The address is about to be looked up. Start bringing its set, tags
+     * and replacement state, into the host cache, without changing
+     * anything.
      */
-    addr_t find_victim(addr_t address);
+    virtual void prefetch(addr_t address) const = 0;
 
-    /* is_victim_dirty:
-     * Check if the tag there is dirty
+    /* fill:
+     * Put the block of a missed lookup in the first invalid way of its set,
+     * or in place of the victim the policy picks if there is none, and
+     * record the evicted line in the result. The set is searched again,
+     * since it may have changed since the lookup.
      */
-    outcome is_victim_dirty(addr_t victim_address);
+    virtual void fill(access_result &result, bool dirty) = 0;
 
-    /* invalidate_victim:
-     * Just invalidate the victim.
+    /* writeback:
+     * A dirty block written back from the level above. Mark it dirty, which
+     * counts as a use for the replacement policy. Return false if it isn't
+     * here.
      */
-    void invalidate_victim(addr_t victim_address);
+    virtual outcome writeback(addr_t address) = 0;
 
-    /* dirtify_victim:
-     * Just dirty the victim.
+    /* invalidate:
+     * Drop the block if it is here, and tell if it was dirty.
      */
-    void dirtify_victim(addr_t victim_address);
+    outcome invalidate(addr_t address, bool &was_dirty);
 
-    /* insert_new_data:
-     * Insert new data that was missing before
+    /* invalidate_way:
+     * Drop the block if it is in the way, without searching the set for
+     * it. Tell if it was dirty and the way the level above holds it in, -1
+     * if it doesn't.
      */
-    void insert_new_data(addr_t address);
+    outcome invalidate_way(addr_t address, int way_nr, bool &was_dirty,
+                           int &upper_way);
+
+    /* track_presence:
+     * Start keeping a presence signature of every set, so that a lookup or
+     * a probe of a block that isn't here mostly skips reading the tags of
+     * the set. Only sets of 8 and 16 ways have one.
+     */
+    void track_presence();
+
+    /* track_upper_ways:
+     * Start keeping, for every way, where the level above holds its block.
+     */
+    void track_upper_ways();
+
+    /* set_upper_way:
+     * The level above put the block of the line in upper_way.
+     */
+    void set_upper_way(const access_result &line, int upper_way);
+
+    /* track_sharing:
+     * Start keeping, for every way, if other caches may share its block.
+     */
+    void track_sharing();
+    bool is_shared(const access_result &line) const;
+    void set_shared(const access_result &line, bool shared);
+
+    /* share:
+     * Another core reads the block: if it is here, it stays as a clean
+     * shared copy. Tell if it was dirty, so its data goes below first.
+     */
+    outcome share(addr_t address, bool &was_dirty);
+
+    /* track_prefetches:
+     * Start keeping, for every way, if a prefetch brought its block in, and
+     * which blocks prefetches evicted.
+     */
+    void track_prefetches();
+
+    /* mark_prefetch:
+     * The block just filled in the way of the result was prefetched, and
+     * arrives at ready_cycle.
+     */
+    void mark_prefetch(const access_result &result, uint64_t ready_cycle);
+
+    /* claim_prefetch:
+     * A demand hit: if a prefetch brought the block in and this is its first
+     * use, clear the mark, tell when the block arrives and return true.
+     */
+    outcome claim_prefetch(const access_result &hit, uint64_t &ready_cycle);
+
+    /* mark_polluted:
+     * A prefetch evicted the block (the address without its offset bits).
+     */
+    void mark_polluted(addr_t block);
+
+    /* claim_polluted:
+     * A demand miss of the block: if a prefetch evicted it and no other
+     * block took its entry since, forget it and return true.
+     */
+    outcome claim_polluted(addr_t block);
+
+    /* add the counters of a cache of another shard of the simulation */
+    void merge_counters(const cache &shard);
+
+    /* reset:
+     * Empty the cache and zero its counters, as it was built but with the
+     * access cycles and write allocation given, keeping its memory. What it
+     * tracks stays tracked.
+     */
+    virtual void reset(int _cycles, bool _write_alloc);
+
+    int get_cycles() const;
+    bool get_write_alloc() const;
+    size_t get_n_access() const;
+    size_t get_n_hits() const;
+    size_t get_n_misses() const;
+};
+
+/* policy_cache:
+ * A cache with the replacement policy Repl compiled in, and for the common
+ * geometries make_cache dispatches to, the number of ways WAYS too. Its set
+ * scans then unroll, and a direct mapped cache skips the policy altogether,
+ * since its only way is always the victim. WAYS is 0 for any other
+ * associativity, known only at run time.
+ */
+template <class Repl, int WAYS = 0> class policy_cache : public cache {
+    Repl repl;
+
+  private:
+    /* the way holding the tag in the set, or -1 */
+    int find_way(set_t set, tag_t tag) const;
+
+  public:
+    policy_cache(int _size, int _block_size, int _cycles, int _assoc,
+                 bool _write_alloc, uint32_t seed, bool huge_pages);
+
+    access_result lookup(addr_t address, op_t op) override;
+    void fill(access_result &result, bool dirty) override;
+    outcome writeback(addr_t address) override;
+    void prefetch(addr_t address) const override;
+    void reset(int _cycles, bool _write_alloc) override;
+};
+
+/* make_cache:
+ * A cache level with the replacement policy. True LRU keeps the queue or
+ * the packed ages as lru asks, and always the queue past
+ * packed_lru::MAX_ASSOC ways. 1, 2, 4, 8 and 16 ways get a policy_cache
+ * specialized for them, any other associativity the generic one.
+ * huge_pages backs the arena of the cache with transparent huge pages.
+ */
+std::unique_ptr<cache> make_cache(int size, int block_size, int cycles,
+                                  int assoc, bool write_alloc, repl_kind repl,
+                                  lru_kind lru, uint32_t seed,
+                                  bool huge_pages);
+
+/* victim_cache:
+ * A small fully associative cache of the blocks L2 evicted, between L2 and
+ * memory. Its entries are the single set of a tag store, tagged with the
+ * whole block number, so a lookup compares against all of them at once like
+ * a CAM. A block found here moves back up to L2, and a block put in when it
+ * is full pushes the oldest one (FIFO) out to memory.
+ */
+class victim_cache {
+  public:
+    static constexpr int ENTRIES = 4;
+    static constexpr int CYCLES = 1;
+
+  private:
+    int block_size;
+
+    cache_arena arena;
+    tag_store entries;
+    uint64_t inserted[ENTRIES]; // = when each entry was put in, for the FIFO
+    uint64_t n_of_inserts = 0;
+
+    // data for printing
+    size_t n_of_access = 0;
+    size_t n_of_hits = 0;
+    // ---------------
+
+  public:
+    explicit victim_cache(int _block_size);
 
-    /* insert_dirty_new_data:
-     * Insert new data that was missing before that is dirty
+    /* lookup:
+     * Count the access and, on a hit, take the block out, since it goes back
+     * to the last level. Tell if it was dirty.
      */
-    void insert_dirty_new_data(addr_t address);
+    outcome lookup(addr_t address, bool &was_dirty);
 
-    /* find_and_write_data:
-     * find and write the data
+    /* take:
+     * Like lookup, without counting the access, for a prefetch.
      */
-    outcome find_and_write_data(addr_t address);
+    outcome take(addr_t address, bool &was_dirty);
 
-    /* set_dirt_status:
-     * set the dirty status to what you want
+    /* write:
+     * Count the access and, on a hit, write the block in place and mark it
+     * dirty. For a write that doesn't allocate in the last level.
      */
-    void set_dirt_status(addr_t address, bool status);
+    outcome write(addr_t address);
 
-    /* set_validity_status:
-     * set the valid status to what you want
+    /* insert:
+     * Put a block the last level evicted in, in place of the oldest entry if
+     * it is full. Return whether the entry pushed out was dirty, and has to
+     * be written back to memory.
      */
-    void set_validity_status(addr_t address, bool status);
+    outcome insert(addr_t address, bool dirty);
+
+    /* empty it and zero its counters */
+    void reset();
 
     size_t get_n_access() const;
     size_t get_n_hits() const;
     size_t get_n_misses() const;
 };
 
+class prefetcher;
+class timing_model;
+struct trace_record;
+
+/* level_config:
+ * One cache level of a configuration. Sizes are log2, like on the command
+ * line, and write_alloc is -1 to follow --wr-alloc.
+ */
+struct level_config {
+    int size = 0;
+    int cycles = 0;
+    int assoc = 0;
+    int write_alloc = -1;
+    repl_kind repl = REPL_LRU;
+    int mshrs = 1; // = misses in flight at once, for the timing model
+};
+
+/* sim_config:
+ * Everything that describes one simulated hierarchy, as given on the command
+ * line. Sizes and associativities are log2, like the flags.
+ */
+struct sim_config {
+    static constexpr int MAX_LEVELS = 4;
+    static constexpr int MAX_CORES = 128;
+
+    int block_size = 0;
+    int mem_cycles = 0;
+    /* what a block written back to memory costs the access that evicted it,
+     * for the bus time it takes from the demand misses */
+    int wb_cycles = 0;
+    /* L1 first, then every level a miss goes down to, before memory */
+    level_config levels[MAX_LEVELS];
+    int n_of_levels = 2;
+    bool write_alloc = false;
+    bool vic_cache = false;
+    inclusion_kind inclusion = INCL_INCLUSIVE;
+    lru_kind lru = LRU_PACKED;
+    int seed = 1;
+    prefetch_kind prefetch = PREFETCH_NONE;
+    int prefetch_level = 1;
+    int prefetch_degree = 1;
+    /* accesses the core issues per cycle, 0 for no timing model */
+    int issue_width = 0;
+    /* each with a private L1, in front of the shared levels */
+    int n_of_cores = 1;
+    /* back the caches with transparent huge pages, a host setting that
+     * doesn't change the results */
+    bool huge_pages = false;
+    /* keep presence signatures in the levels where most lookups miss, the
+     * ones below L1 and the snooped L1s of several cores. A host setting
+     * too, it only skips set scans that would find nothing */
+    bool presence_filter = false;
+};
+
+/* simulator:
+ * The hierarchy, an ordered list of cache levels from L1 down to the last
+ * level before memory, and an optional victim cache between the last level
+ * and memory.
+ * By default every level is inclusive of the ones above it: a miss brings
+ * the block into every level it missed in, and a line a level evicts is
+ * also dropped from the levels above it. A NINE hierarchy fills the same
+ * way but drops nothing above. An exclusive one moves a block up to the
+ * level that missed, out of the level it was found in, and moves every
+ * line a level evicts down to the next one.
+ * With several cores, each has a private L1 and the levels below are
+ * shared. The L1s are kept coherent with MESI, by snooping the others on
+ * every miss and on every write to a shared line.
+ */
 class simulator {
-    simulator(int _block_size, int _mem_cycles, int _l1_size, int _l1_cycles,
-              int _l1_assoc, int _l2_size, int _l2_cycles, int _l2_assoc,
-              bool _write_alloc); // singleton
+    /* records process_requests prefetches ahead of the one it simulates */
+    static constexpr size_t REQUEST_PREFETCH_DISTANCE = 8;
 
+    sim_config config; // = being simulated, since the last reset
     int block_size;
     int mem_cycles;
-    int l1_size;
-    int l1_cycles;
-    int l1_assoc;
-    int l2_size;
-    int l2_cycles;
-    int l2_assoc;
+    int wb_cycles;
+    inclusion_kind inclusion;
 
     // data for printing
     size_t total_access_cycles = 0;
     size_t n_of_access = 0;
+    /* blocks moved between each level and the one below it, both ways, the
+     * last level's to memory. The trace has no access sizes, so a write that
+     * doesn't allocate moves a whole block too */
+    std::vector<uint64_t> link_blocks;
+    std::vector<size_t> n_of_writebacks; // = dirty lines each level evicted
     // ---------------
 
-    bool write_alloc;
+    bool vic_cache;
+
+    /* the L1 of every core, then the shared levels */
+    std::vector<std::unique_ptr<cache>> caches;
+    /* the hierarchy of the core being simulated, levels[0] is its L1 */
+    std::vector<cache *> levels;
+    size_t n_of_cores;
+    size_t core; // = of the access being simulated
+    victim_cache VC;
 
-    cache L1;
-    cache L2;
+    std::unique_ptr<prefetcher> PF;
+    size_t prefetch_level; // = the level the prefetcher watches and fills
+    std::vector<addr_t> prefetches;
+
+    /* the demand misses of the access being simulated, for the timing */
+    std::unique_ptr<timing_model> timing;
+    size_t n_of_demand_misses = 0; // = levels the access filled, from L1
+    int demand_below_cycles = 0;
+
+    // coherence data for printing, per core
+    std::vector<size_t> n_of_invalidations; // = lines other cores took
+    std::vector<size_t> n_of_upgrades;      // = writes to shared lines
+    // ---------------
+
+    // prefetch data for printing
+    size_t n_of_prefetches = 0;
+    size_t n_of_useful_prefetches = 0;
+    size_t n_of_late_prefetches = 0;
+    size_t n_of_pollution_misses = 0;
+    // ---------------
 
   private:
     void do_read(addr_t address);
     void do_write(addr_t address);
 
-    void log_l1_access();
-    void log_l2_access();
+    /* start bringing the sets of the address, in every level the core
+     * reaches, into the host cache */
+    void prefetch_sets(addr_t address, int core_nr) const;
+
+    /* bring_into:
+     * Handle a miss in the level: read the block from the level below, or
+     * from further down through it, and fill it in, dirty for an allocating
+     * write.
+     */
+    void bring_into(size_t level_nr, access_result &miss, bool dirty);
+
+    /* write_below:
+     * A write that didn't allocate in the levels above: write it in the
+     * level, or pass it further down if it misses and doesn't allocate
+     * there either.
+     */
+    void write_below(size_t level_nr, addr_t address);
+
+    /* fill_level:
+     * Put the block of a miss in the level once the levels below have it,
+     * and take care of the line it evicted: drop it from the levels above if
+     * inclusive, and send it below. For the last level, this is where the
+     * block comes from the victim cache or memory. Return the cycles that
+     * took.
+     */
+    int fill_level(size_t level_nr, access_result &miss, bool dirty,
+                   bool demand);
+
+    /* evict_below:
+     * A line the level evicted, dirty if any copy of it was, leaves for the
+     * level below: all of them in an exclusive hierarchy, only dirty ones
+     * otherwise, passed further down if the level below doesn't have them.
+     * Lines the last level evicts go to the victim cache or memory. Return
+     * what the writebacks to memory cost.
+     */
+    int evict_below(size_t level_nr, addr_t victim, bool dirty);
+
+    /* move_up:
+     * The miss of an exclusive level: find the block below, or in the victim
+     * cache or memory, take it out of there and fill it in. A demand miss
+     * counts the lookups, a prefetch only probes. Return the cycles it took
+     * below the level.
+     */
+    int move_up(size_t level_nr, access_result &miss, bool dirty, bool demand);
+
+    /* share_others:
+     * The core missed the block: the L1s of the others keep their copies as
+     * shared, writing modified ones back. Return if any had a copy.
+     */
+    bool share_others(addr_t address);
+
+    /* invalidate_others:
+     * The core writes the block: the L1s of the others drop their copies,
+     * writing modified ones back.
+     */
+    void invalidate_others(addr_t address);
+
+    void log_access(size_t level_nr);
+    void log_vic_access();
     void log_mem_access();
 
+    /* write_to_mem:
+     * Count a block written back to memory, and return what it costs.
+     */
+    int write_to_mem();
+
+    /* read_below_llc:
+     * A miss in the last level: get the block from the victim cache if it
+     * is there, and tell if it was dirty, or from memory. Only a demand miss
+     * counts as a victim cache access. Return the cycles it took.
+     */
+    int read_below_llc(const access_result &llc_miss, bool &vic_dirty,
+                       bool demand);
+
+    /* observe_demand:
+     * A demand access to the prefetched level is done: count the use of a
+     * prefetched block, stalling for it if it hasn't arrived yet, or a miss
+     * a prefetch caused, then train the prefetcher and issue what it asks
+     * for.
+     */
+    void observe_demand(const access_result &result);
+
+    /* prefetch_into:
+     * Bring a missing block into the level, and into the levels below on the
+     * way, without counting any access. Return how long the fetch takes.
+     */
+    int prefetch_into(size_t level_nr, access_result &miss);
+
+    /* prefetch_block:
+     * Bring the block into the prefetched level, unless it is there already.
+     * Nothing is charged to the accesses.
+     */
+    void prefetch_block(addr_t address);
+
   public:
+    explicit simulator(const sim_config &_config);
+    ~simulator();
+
     simulator(const simulator &) = delete;
     simulator &operator=(const simulator &) = delete;
 
-    static simulator &getInstance(int _block_size, int _mem_cycles,
-                                  int _l1_size, int _l1_cycles, int _l1_assoc,
-                                  int _l2_size, int _l2_cycles, int _l2_assoc,
-                                  bool _write_alloc);
+    /* the core is folded onto the cores simulated */
+    void process_request(char operation, addr_t address, int core_nr);
+
+    /* process_requests:
+     * Simulate a batch of decoded records in order, the same as one
+     * process_request each. While a record is simulated, the sets the
+     * record REQUEST_PREFETCH_DISTANCE ahead maps to, in every level of its
+     * core, are prefetched into the host cache, so the host misses of big
+     * simulated caches overlap with the simulation instead of stalling it.
+     */
+    void process_requests(const trace_record *records, size_t n_of_records);
+
+    /* merge:
+     * Add the counters of another shard of the same configuration, so this
+     * one reports the whole run.
+     */
+    void merge(const simulator &shard);
 
-    void process_request(char operation, addr_t address);
+    /* reset:
+     * Back to as built, for the configuration, to run the trace through
+     * another configuration of the same geometry (see describe_geometry). The
+     * caches keep their memory, only the pages the last run wrote are
+     * handed back.
+     */
+    void reset(const sim_config &_config);
 
-    double calc_L1_miss_rate() const;
-    double calc_L2_miss_rate() const;
+    const sim_config &get_config() const;
+    size_t get_n_of_levels() const;
+    /* miss rate of the level, 0 is the L1s of all the cores */
+    double calc_miss_rate(size_t level_nr) const;
+    size_t get_n_of_cores() const;
+    double calc_core_miss_rate(size_t core_nr) const;
+    size_t get_n_of_invalidations(size_t core_nr) const;
+    size_t get_n_of_upgrades(size_t core_nr) const;
+    /* bytes moved between the level and the one below it, or memory */
+    uint64_t calc_traffic_bytes(size_t level_nr) const;
+    size_t get_n_writebacks(size_t level_nr) const;
+    bool has_vic_cache() const;
+    double calc_vic_hit_rate() const;
+    bool has_prefetcher() const;
+    /* useful / issued prefetches */
+    double calc_prefetch_accuracy() const;
+    /* misses the prefetches removed / misses without them */
+    double calc_prefetch_coverage() const;
+    /* useful prefetches that arrived before their use / useful ones */
+    double calc_prefetch_timeliness() const;
+    /* misses to blocks a prefetch evicted / misses */
+    double calc_prefetch_pollution() const;
     double calc_avg_access_time() const;
+    bool has_timing() const;
+    /* cycles until the last access finished, in the timing model */
+    uint64_t get_n_of_cycles() const;
+    /* cycles the core couldn't issue for lack of an L1 MSHR */
+    uint64_t get_n_of_stall_cycles() const;
+    /* accesses that merged with a miss in flight to their block */
+    size_t get_n_of_merged() const;
+    double calc_mlp() const;
 };
 
 #endif
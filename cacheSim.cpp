@@ -1,17 +1,26 @@
 #include "cache.h"
+#include "config.h"
+#include "prefetch.h"
+#include "stack_dist.h"
+#include "sweep.h"
+#include "timing.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstdarg>
 #include <cstdlib>
-#include <fstream>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <memory>
+#include <new>
 #include <stdexcept>
+#include <sys/mman.h>
+#include <thread>
 
 using std::cerr;
 using std::cout;
 using std::endl;
 using std::FILE;
-using std::ifstream;
 using std::string;
-using std::stringstream;
 
 // ---------------------------- HELPER FUNCTIONS ---------------------------- //
 
@@ -30,145 +39,421 @@ static int ttp(int exponent) {
 
 // ---------------------------- SIMULATOR ----------------------------  //
 
-simulator::simulator(int _block_size, int _mem_cycles, int _l1_size,
-                     int _l1_cycles, int _l1_assoc, int _l2_size,
-                     int _l2_cycles, int _l2_assoc, bool _write_alloc)
-    : block_size(_block_size), mem_cycles(_mem_cycles), l1_size(_l1_size),
-      l1_cycles(_l1_cycles), l1_assoc(_l1_assoc), l2_size(_l2_size),
-      l2_cycles(_l2_cycles), l2_assoc(_l2_assoc), write_alloc(_write_alloc),
-      L1(l1_size, block_size, l1_cycles, l1_assoc, write_alloc),
-      L2(l2_size, block_size, l2_cycles, l2_assoc, write_alloc) {}
-
-simulator &simulator::getInstance(int _block_size, int _mem_cycles,
-                                  int _l1_size, int _l1_cycles, int _l1_assoc,
-                                  int _l2_size, int _l2_cycles, int _l2_assoc,
-                                  bool _write_alloc) {
-
-    /* Creating a static instance of the simulator because we don't need more
-     * than one
-     */
-    static simulator instance(_block_size,
-                              _mem_cycles,
-                              _l1_size,
-                              _l1_cycles,
-                              _l1_assoc,
-                              _l2_size,
-                              _l2_cycles,
-                              _l2_assoc,
-                              _write_alloc);
-    return instance;
+/* the timing model of the configuration, or none without an issue width */
+static timing_model *make_timing(const sim_config &config) {
+    if (!config.issue_width) return nullptr;
+    std::vector<int> level_cycles, n_of_mshrs;
+    for (int level_nr = 0; level_nr < config.n_of_levels; level_nr++) {
+        level_cycles.push_back(config.levels[level_nr].cycles);
+        n_of_mshrs.push_back(config.levels[level_nr].mshrs);
+    }
+    return new timing_model(config.issue_width, level_cycles, n_of_mshrs,
+                            config.n_of_cores);
+}
+
+/* whether the level allocates on a write miss, its own flag or else the
+ * configuration's */
+static bool level_write_alloc(const sim_config &config, int level_nr) {
+    const level_config &level = config.levels[level_nr];
+    return level.write_alloc < 0 ? config.write_alloc : level.write_alloc != 0;
+}
+
+simulator::simulator(const sim_config &_config)
+    : config(_config), block_size(config.block_size),
+      mem_cycles(config.mem_cycles), wb_cycles(config.wb_cycles),
+      inclusion(config.inclusion),
+      link_blocks(config.n_of_levels), n_of_writebacks(config.n_of_levels),
+      vic_cache(config.vic_cache), n_of_cores(config.n_of_cores), core(0),
+      VC(block_size),
+      PF(make_prefetcher(config.prefetch, block_size, config.prefetch_degree)),
+      prefetch_level(config.prefetch_level - 1),
+      n_of_invalidations(config.n_of_cores), n_of_upgrades(config.n_of_cores) {
+    for (int level_nr = 0; level_nr < config.n_of_levels; level_nr++) {
+        const level_config &level = config.levels[level_nr];
+        bool write_alloc = level_write_alloc(config, level_nr);
+        size_t n_of_copies = level_nr == 0 ? n_of_cores : 1;
+        for (size_t copy = 0; copy < n_of_copies; copy++) {
+            caches.push_back(make_cache(level.size, block_size, level.cycles,
+                                        level.assoc, write_alloc, level.repl,
+                                        config.lru, config.seed,
+                                        config.huge_pages));
+        }
+    }
+    levels.push_back(caches[0].get());
+    for (size_t i = n_of_cores; i < caches.size(); i++) {
+        levels.push_back(caches[i].get());
+    }
+
+    /* inclusive, every level below L1 knows where the one above holds its
+     * blocks, so an eviction goes straight to their ways. A level below
+     * several L1s snoops them all instead */
+    for (size_t level_nr = n_of_cores > 1 ? 2 : 1;
+         inclusion == INCL_INCLUSIVE && level_nr < levels.size(); level_nr++) {
+        levels[level_nr]->track_upper_ways();
+    }
+    for (size_t core_nr = 0; n_of_cores > 1 && core_nr < n_of_cores;
+         core_nr++) {
+        caches[core_nr]->track_sharing();
+    }
+    /* an L1 of a single core mostly hits, the filter would only cost it */
+    for (size_t i = n_of_cores > 1 ? 0 : 1;
+         config.presence_filter && i < caches.size(); i++) {
+        caches[i]->track_presence();
+    }
+
+    timing.reset(make_timing(config));
+
+    if (!PF) return;
+    levels[prefetch_level]->track_prefetches();
 }
 
+simulator::~simulator() {}
+
 void simulator::do_read(addr_t address) {
-    addr_t victim_address = 0;
-    log_l1_access();
-    if (!L1.find_and_read_data(address)) {
-        log_l2_access();
-        if (!L2.find_and_read_data(address)) {
-            /* We didn't find the data in L2 and L1, so we need to get it from
-             * memory. */
+    log_access(0);
+    access_result l1_result = levels[0]->lookup(address, OP_READ);
+    if (!l1_result.hit && n_of_cores > 1) {
+        /* exclusive unless another core has it too */
+        bool shared = share_others(address);
+        bring_into(0, l1_result, false);
+        levels[0]->set_shared(l1_result, shared);
+    } else if (!l1_result.hit) {
+        bring_into(0, l1_result, false);
+    }
+    if (PF && prefetch_level == 0) observe_demand(l1_result);
+}
+
+void simulator::do_write(addr_t address) {
+    log_access(0);
+    access_result l1_result = levels[0]->lookup(address, OP_WRITE);
+    if (n_of_cores > 1 && (!l1_result.hit || levels[0]->is_shared(l1_result))) {
+        /* the others' copies go before the core writes */
+        invalidate_others(address);
+        if (l1_result.hit) {
+            /* an upgrade, the invalidation goes out over the shared level */
+            n_of_upgrades[core]++;
+            total_access_cycles += levels[1]->get_cycles();
+            levels[0]->set_shared(l1_result, false);
+        }
+    }
+    if (l1_result.hit) {
+        /* nothing to do */
+    } else if (levels[0]->get_write_alloc()) {
+        bring_into(0, l1_result, true);
+    } else { /* no write allocate, very simple */
+        write_below(1, address);
+        /* posted, the core doesn't wait for it */
+        n_of_demand_misses = 0;
+    }
+    if (PF && prefetch_level == 0) observe_demand(l1_result);
+}
+
+void simulator::bring_into(size_t level_nr, access_result &miss, bool dirty) {
+    if (inclusion == INCL_EXCLUSIVE) {
+        total_access_cycles += move_up(level_nr, miss, dirty, true);
+        return;
+    }
+
+    bool has_below = level_nr + 1 < levels.size();
+    access_result below;
+    if (has_below) {
+        log_access(level_nr + 1);
+        /* a write miss above is only a read for the level below */
+        below = levels[level_nr + 1]->lookup(miss.address, OP_READ);
+        if (!below.hit) bring_into(level_nr + 1, below, false);
+    }
+
+    /* write new data into the level, once every level below has it */
+    int cycles = fill_level(level_nr, miss, dirty, true);
+    if (has_below) levels[level_nr + 1]->set_upper_way(below, miss.way_nr);
+    total_access_cycles += cycles;
+    n_of_demand_misses = std::max(n_of_demand_misses, level_nr + 1);
+    if (!has_below) demand_below_cycles = cycles;
+    if (has_below && PF && prefetch_level == level_nr + 1) {
+        observe_demand(below);
+    }
+}
+
+void simulator::write_below(size_t level_nr, addr_t address) {
+    if (level_nr == levels.size()) {
+        /* past the last level, the write goes to memory */
+        bool vic_hit = false;
+        if (vic_cache) {
+            log_vic_access();
+            vic_hit = VC.write(address);
+        }
+        if (!vic_hit) {
             log_mem_access();
+            link_blocks.back()++;
+        }
+        return;
+    }
+
+    link_blocks[level_nr - 1]++;
+
+    cache &level = *levels[level_nr];
+    log_access(level_nr);
+    access_result result = level.lookup(address, OP_WRITE);
+    if (result.hit) {
+        /* nothing to do */
+    } else if (level.get_write_alloc()) {
+        bring_into(level_nr, result, true);
+    } else {
+        write_below(level_nr + 1, address);
+    }
+    if (PF && prefetch_level == level_nr) observe_demand(result);
+}
 
-            /* start snoop */
-            victim_address = L2.find_victim(address);
-            if (L1.is_victim_dirty(victim_address)) {
-                /* write to L2 */
-                L2.dirtify_victim(victim_address);
+int simulator::fill_level(size_t level_nr, access_result &miss, bool dirty,
+                          bool demand) {
+    bool last_level = level_nr + 1 == levels.size();
+    levels[level_nr]->fill(miss, dirty);
+    int cycles = 0;
+    if (last_level) {
+        /* We didn't find the data in any level, so we needed to get it from
+         * the victim cache or memory. */
+        bool vic_dirty = false;
+        cycles = read_below_llc(miss, vic_dirty, demand);
+        /* the block moves back up to the last level, and keeps its data */
+        if (vic_dirty) levels.back()->writeback(miss.address);
+    } else {
+        link_blocks[level_nr]++;
+    }
+    if (!miss.evicted) return cycles;
+
+    bool victim_dirty = miss.victim_dirty;
+    if (inclusion == INCL_INCLUSIVE) {
+        /* snoop: the victim can't stay in the levels above. Each level knows
+         * the way the one above holds it in, and if that one doesn't, none
+         * further up does */
+        int way_nr = miss.victim_upper_way;
+        size_t upper = level_nr;
+        for (; upper > 0 && (upper > 1 || n_of_cores == 1); upper--) {
+            bool was_dirty = false;
+            if (way_nr < 0 ||
+                !levels[upper - 1]->invalidate_way(miss.victim_address,
+                                                   way_nr, was_dirty, way_nr)) {
+                break;
             }
-            L1.invalidate_victim(victim_address);
-            /*
-             *            if (L2.is_victim_dirty(victim_address)) {
-             *                <write to memeory>
+            victim_dirty = victim_dirty || was_dirty;
+        }
+        /* the shared level under the L1s only knows they may have it */
+        for (size_t core_nr = 0; upper == 1 && core_nr < n_of_cores;
+             core_nr++) {
+            bool was_dirty = false;
+            caches[core_nr]->invalidate(miss.victim_address, was_dirty);
+            victim_dirty = victim_dirty || was_dirty;
         }
-        * no need for this, because write back is done in the background,
-        * but this is what is happening in the background.
-        */
-            L2.invalidate_victim(victim_address);
+    }
+    if (victim_dirty) n_of_writebacks[level_nr]++;
+    return cycles + evict_below(level_nr, miss.victim_address, victim_dirty);
+}
+
+int simulator::evict_below(size_t level_nr, addr_t victim, bool dirty) {
+    if (level_nr + 1 == levels.size()) {
+        /* swap in the line the last level evicted, after the lookup so it
+         * can't push out the block being looked for */
+        if (vic_cache) return VC.insert(victim, dirty) ? write_to_mem() : 0;
+        return dirty ? write_to_mem() : 0;
+    }
+
+    cache &below = *levels[level_nr + 1];
+    if (inclusion == INCL_EXCLUSIVE) {
+        /* every victim moves down, and may push one out of the level below */
+        link_blocks[level_nr]++;
+        access_result slot = below.probe(victim);
+        below.fill(slot, dirty);
+        if (!slot.evicted) return 0;
+        if (slot.victim_dirty) n_of_writebacks[level_nr + 1]++;
+        return evict_below(level_nr + 1, slot.victim_address,
+                           slot.victim_dirty);
+    }
+
+    if (!dirty) return 0;
+    link_blocks[level_nr]++;
+    if (below.writeback(victim)) return 0;
+    /* not inclusive, the level below dropped it already, so the data goes on
+     * to the next one down */
+    return evict_below(level_nr + 1, victim, true);
+}
 
-            /* end of snoop, write new data into L2 */
-            L2.insert_new_data(address);
+int simulator::move_up(size_t level_nr, access_result &miss, bool dirty,
+                       bool demand) {
+    /* the block is in a single level at most, look for it down from here */
+    int cycles = 0;
+    size_t found = level_nr + 1;
+    for (; found < levels.size(); found++) {
+        cache &below = *levels[found];
+        access_result result;
+        if (demand) {
+            log_access(found);
+            result = below.lookup(miss.address, OP_READ);
+        } else {
+            cycles += below.get_cycles();
+            result = below.probe(miss.address);
         }
+        if (!result.hit) continue;
+
+        /* take it out of there, data and all */
+        bool was_dirty = false;
+        below.invalidate(miss.address, was_dirty);
+        dirty = dirty || was_dirty;
+        break;
+    }
+    if (found == levels.size()) {
+        bool vic_dirty = false;
+        cycles += read_below_llc(miss, vic_dirty, demand);
+        dirty = dirty || vic_dirty;
+    }
+    for (size_t link = level_nr; link < found && link + 1 < levels.size();
+         link++) {
+        link_blocks[link]++;
+    }
+    if (demand) {
+        n_of_demand_misses = found;
+        if (found == levels.size()) demand_below_cycles = cycles;
+    }
+
+    levels[level_nr]->fill(miss, dirty);
+    if (!miss.evicted) return cycles;
+    if (miss.victim_dirty) n_of_writebacks[level_nr]++;
+    return cycles +
+           evict_below(level_nr, miss.victim_address, miss.victim_dirty);
+}
+
+int simulator::read_below_llc(const access_result &llc_miss, bool &vic_dirty,
+                              bool demand) {
+    int cycles = 0;
+    bool vic_hit = false;
+    if (vic_cache) {
+        cycles += victim_cache::CYCLES;
+        vic_hit = demand ? VC.lookup(llc_miss.address, vic_dirty)
+                         : VC.take(llc_miss.address, vic_dirty);
+    }
+    if (!vic_hit) {
+        cycles += mem_cycles;
+        link_blocks.back()++;
+    }
+    return cycles;
+}
 
-        /* find a place to write into L1 */
-        victim_address = L1.find_victim(address);
-        if (L1.is_victim_dirty(victim_address)) {
-            /* write to L2 */
-            L2.dirtify_victim(victim_address);
+void simulator::observe_demand(const access_result &result) {
+    cache &level = *levels[prefetch_level];
+    addr_t block = result.address >> block_size;
+
+    uint64_t ready_cycle;
+    bool first_use = result.hit && level.claim_prefetch(result, ready_cycle);
+    if (first_use) {
+        n_of_useful_prefetches++;
+        if (ready_cycle > total_access_cycles) {
+            /* late, the access waits for the rest of the fetch */
+            n_of_late_prefetches++;
+            total_access_cycles = ready_cycle;
         }
-        L1.invalidate_victim(victim_address);
+    } else if (!result.hit && level.claim_polluted(block)) {
+        n_of_pollution_misses++;
+    }
 
-        /* end of snoop, write new data into L1 */
-        L1.insert_new_data(address);
+    prefetches.clear();
+    PF->observe(block, result.hit, first_use, prefetches);
+    for (size_t i = 0; i < prefetches.size(); i++) {
+        prefetch_block(prefetches[i] << block_size);
     }
 }
 
-void simulator::do_write(addr_t address) {
-    if (write_alloc) {
-        addr_t victim_address = 0;
-        log_l1_access();
-        if (!L1.find_and_write_data(address)) {
-            log_l2_access();
-            if (!L2.find_and_read_data(address)) {
-                /* We didn't find the data in L2 and L1, so we need to get it
-                 * from memory. */
-                log_mem_access();
-
-                /* start snoop */
-                victim_address = L2.find_victim(address);
-                if (L1.is_victim_dirty(victim_address)) {
-                    /* write to L2 */
-                    L2.dirtify_victim(victim_address);
-                }
-                L1.invalidate_victim(victim_address);
-                /*
-                 *                if (L2.is_victim_dirty(victim_address)) {
-                 *                    <write to memeory>
-            }
-            */
-                L2.invalidate_victim(victim_address);
+int simulator::prefetch_into(size_t level_nr, access_result &miss) {
+    if (inclusion == INCL_EXCLUSIVE) {
+        return move_up(level_nr, miss, false, false);
+    }
 
-                /* end of snoop, write new data into L2 */
-                L2.insert_new_data(address);
-            }
+    if (level_nr + 1 == levels.size()) {
+        return fill_level(level_nr, miss, false, false);
+    }
 
-            /* find a place to write into L1 */
-            victim_address = L1.find_victim(address);
-            if (L1.is_victim_dirty(victim_address)) {
-                /* write to L2 */
-                L2.dirtify_victim(victim_address);
-            }
-            L1.invalidate_victim(victim_address);
+    cache &below = *levels[level_nr + 1];
+    int cycles = below.get_cycles();
+    access_result found = below.probe(miss.address);
+    if (!found.hit) cycles += prefetch_into(level_nr + 1, found);
+    cycles += fill_level(level_nr, miss, false, false);
+    below.set_upper_way(found, miss.way_nr);
+    return cycles;
+}
+
+void simulator::prefetch_block(addr_t address) {
+    cache &level = *levels[prefetch_level];
+    access_result result = level.probe(address);
+    if (result.hit) return;
+    n_of_prefetches++;
 
-            /* end of snoop, write new data into L1 */
-            L1.insert_dirty_new_data(address);
+    /* the fetch starts now, and takes as long as a demand miss would */
+    uint64_t ready_cycle = total_access_cycles;
+    ready_cycle += prefetch_into(prefetch_level, result);
+    level.mark_prefetch(result, ready_cycle);
+
+    if (result.evicted) {
+        level.mark_polluted(result.victim_address >> block_size);
+    }
+}
+
+bool simulator::share_others(addr_t address) {
+    bool shared = false;
+    for (size_t core_nr = 0; core_nr < n_of_cores; core_nr++) {
+        bool was_dirty = false;
+        if (core_nr == core || !caches[core_nr]->share(address, was_dirty)) {
+            continue;
         }
-    } else { /* no write allocate, very simple */
-        log_l1_access();
-        if (!L1.find_and_write_data(address)) {
-            log_l2_access();
-            if (!L2.find_and_write_data(address)) {
-                log_mem_access();
-            }
+        shared = true;
+        if (was_dirty) {
+            n_of_writebacks[0]++;
+            total_access_cycles += evict_below(0, address, true);
+        }
+    }
+    return shared;
+}
+
+void simulator::invalidate_others(addr_t address) {
+    for (size_t core_nr = 0; core_nr < n_of_cores; core_nr++) {
+        bool was_dirty = false;
+        if (core_nr == core ||
+            !caches[core_nr]->invalidate(address, was_dirty)) {
+            continue;
+        }
+        n_of_invalidations[core_nr]++;
+        if (was_dirty) {
+            n_of_writebacks[0]++;
+            total_access_cycles += evict_below(0, address, true);
         }
     }
 }
 
-void simulator::log_l1_access() {
+void simulator::log_access(size_t level_nr) {
     /* only need to increment the access amount of the first access try, that
      * always starts at L1 */
-    n_of_access++;
-    total_access_cycles += l1_cycles;
+    if (level_nr == 0) n_of_access++;
+    total_access_cycles += levels[level_nr]->get_cycles();
 }
 
-void simulator::log_l2_access() {
-    total_access_cycles += l2_cycles;
+void simulator::log_vic_access() {
+    total_access_cycles += victim_cache::CYCLES;
 }
 
 void simulator::log_mem_access() {
     total_access_cycles += mem_cycles;
 }
 
-void simulator::process_request(char operation, addr_t address) {
+int simulator::write_to_mem() {
+    /* the write itself is done in the background, wb_cycles is the bus time
+     * it takes from the accesses */
+    link_blocks.back()++;
+    return wb_cycles;
+}
+
+void simulator::process_request(char operation, addr_t address,
+                                int core_nr) {
+    core = core_nr % n_of_cores;
+    levels[0] = caches[core].get();
+    n_of_demand_misses = 0;
+    demand_below_cycles = 0;
     switch (operation) {
     case 'r':
         do_read(address);
@@ -179,35 +464,193 @@ void simulator::process_request(char operation, addr_t address) {
     default:
         throw std::logic_error("No such operation"); /* shouldn't happen */
     }
+    if (timing) {
+        timing->access(core, address >> block_size, n_of_demand_misses,
+                       demand_below_cycles);
+    }
+}
+
+void simulator::prefetch_sets(addr_t address, int core_nr) const {
+    caches[core_nr % n_of_cores]->prefetch(address);
+    for (size_t level_nr = 1; level_nr < levels.size(); level_nr++) {
+        levels[level_nr]->prefetch(address);
+    }
+}
+
+void simulator::process_requests(const trace_record *records,
+                                 size_t n_of_records) {
+    size_t ahead = std::min(REQUEST_PREFETCH_DISTANCE, n_of_records);
+    for (size_t i = 0; i < ahead; i++) {
+        prefetch_sets(records[i].address, records[i].core);
+    }
+    for (size_t i = 0; i < n_of_records; i++) {
+        if (ahead < n_of_records) {
+            prefetch_sets(records[ahead].address, records[ahead].core);
+            ahead++;
+        }
+        process_request(records[i].op, records[i].address, records[i].core);
+    }
+}
+
+void simulator::merge(const simulator &shard) {
+    total_access_cycles += shard.total_access_cycles;
+    n_of_access += shard.n_of_access;
+    for (size_t level_nr = 0; level_nr < levels.size(); level_nr++) {
+        link_blocks[level_nr] += shard.link_blocks[level_nr];
+        n_of_writebacks[level_nr] += shard.n_of_writebacks[level_nr];
+    }
+    for (size_t i = 0; i < caches.size(); i++) {
+        caches[i]->merge_counters(*shard.caches[i]);
+    }
+    for (size_t core_nr = 0; core_nr < n_of_cores; core_nr++) {
+        n_of_invalidations[core_nr] += shard.n_of_invalidations[core_nr];
+        n_of_upgrades[core_nr] += shard.n_of_upgrades[core_nr];
+    }
+}
+
+void simulator::reset(const sim_config &_config) {
+    config = _config;
+    mem_cycles = config.mem_cycles;
+    wb_cycles = config.wb_cycles;
+    total_access_cycles = 0;
+    n_of_access = 0;
+    link_blocks.assign(link_blocks.size(), 0);
+    n_of_writebacks.assign(n_of_writebacks.size(), 0);
+    /* the L1s of the cores first, then one cache a level */
+    for (size_t i = 0; i < caches.size(); i++) {
+        int level_nr = i < n_of_cores ? 0 : (int)(i - n_of_cores) + 1;
+        caches[i]->reset(config.levels[level_nr].cycles,
+                         level_write_alloc(config, level_nr));
+    }
+    core = 0;
+    levels[0] = caches[0].get();
+    VC.reset();
+
+    /* the prefetcher and the timing model are small, build them again */
+    PF = make_prefetcher(config.prefetch, block_size, config.prefetch_degree);
+    prefetches.clear();
+    timing.reset(make_timing(config));
+    n_of_demand_misses = 0;
+    demand_below_cycles = 0;
+
+    n_of_invalidations.assign(n_of_cores, 0);
+    n_of_upgrades.assign(n_of_cores, 0);
+    n_of_prefetches = 0;
+    n_of_useful_prefetches = 0;
+    n_of_late_prefetches = 0;
+    n_of_pollution_misses = 0;
 }
 
 /* calculations */
-double simulator::calc_L1_miss_rate() const {
-    return (double)L1.get_n_misses() / (double)L1.get_n_access();
+const sim_config &simulator::get_config() const {
+    return config;
+}
+size_t simulator::get_n_of_levels() const {
+    return levels.size();
+}
+double simulator::calc_miss_rate(size_t level_nr) const {
+    if (level_nr > 0) {
+        const cache &level = *levels[level_nr];
+        return (double)level.get_n_misses() / (double)level.get_n_access();
+    }
+    size_t n_of_misses = 0, n_of_l1_access = 0;
+    for (size_t core_nr = 0; core_nr < n_of_cores; core_nr++) {
+        n_of_misses += caches[core_nr]->get_n_misses();
+        n_of_l1_access += caches[core_nr]->get_n_access();
+    }
+    return (double)n_of_misses / (double)n_of_l1_access;
+}
+size_t simulator::get_n_of_cores() const {
+    return n_of_cores;
+}
+double simulator::calc_core_miss_rate(size_t core_nr) const {
+    const cache &l1 = *caches[core_nr];
+    /* a core the trace never names has no accesses */
+    if (l1.get_n_access() == 0) return 0;
+    return (double)l1.get_n_misses() / (double)l1.get_n_access();
+}
+size_t simulator::get_n_of_invalidations(size_t core_nr) const {
+    return n_of_invalidations[core_nr];
 }
-double simulator::calc_L2_miss_rate() const {
-    return (double)L2.get_n_misses() / (double)L2.get_n_access();
+size_t simulator::get_n_of_upgrades(size_t core_nr) const {
+    return n_of_upgrades[core_nr];
+}
+uint64_t simulator::calc_traffic_bytes(size_t level_nr) const {
+    return link_blocks[level_nr] << block_size;
+}
+size_t simulator::get_n_writebacks(size_t level_nr) const {
+    return n_of_writebacks[level_nr];
+}
+bool simulator::has_vic_cache() const {
+    return vic_cache;
+}
+double simulator::calc_vic_hit_rate() const {
+    return (double)VC.get_n_hits() / (double)VC.get_n_access();
+}
+bool simulator::has_prefetcher() const {
+    return (bool)PF;
+}
+/* the prefetch ratios are 0 when nothing was there to count */
+double simulator::calc_prefetch_accuracy() const {
+    if (n_of_prefetches == 0) return 0;
+    return (double)n_of_useful_prefetches / (double)n_of_prefetches;
+}
+double simulator::calc_prefetch_coverage() const {
+    const cache &level = *levels[prefetch_level];
+    size_t n_of_misses = n_of_useful_prefetches + level.get_n_misses();
+    if (n_of_misses == 0) return 0;
+    return (double)n_of_useful_prefetches / (double)n_of_misses;
+}
+double simulator::calc_prefetch_timeliness() const {
+    if (n_of_useful_prefetches == 0) return 0;
+    return (double)(n_of_useful_prefetches - n_of_late_prefetches) /
+           (double)n_of_useful_prefetches;
+}
+double simulator::calc_prefetch_pollution() const {
+    const cache &level = *levels[prefetch_level];
+    if (level.get_n_misses() == 0) return 0;
+    return (double)n_of_pollution_misses / (double)level.get_n_misses();
 }
 double simulator::calc_avg_access_time() const {
     return (double)total_access_cycles / (double)n_of_access;
 }
+bool simulator::has_timing() const {
+    return (bool)timing;
+}
+uint64_t simulator::get_n_of_cycles() const {
+    return timing->get_n_of_cycles();
+}
+uint64_t simulator::get_n_of_stall_cycles() const {
+    return timing->get_n_of_stall_cycles();
+}
+size_t simulator::get_n_of_merged() const {
+    return timing->get_n_of_merged();
+}
+double simulator::calc_mlp() const {
+    return timing->calc_mlp();
+}
 
 // ---------------------------- CACHE ----------------------------  //
 
+/* the bytes all the state of a cache may take from its arena: the tags,
+ * the policy, at most a word per way and one per set (FIFO), and the per
+ * way arrays it may track, with room to align each of them */
+static size_t arena_bytes(int assoc, int n_of_sets) {
+    size_t per_way = sizeof(uint64_t) + sizeof(uint64_t) + sizeof(addr_t) +
+                     sizeof(int) + sizeof(uint8_t);
+    size_t per_set = sizeof(uint64_t) + per_way * assoc;
+    return tag_store::bytes_needed(assoc, n_of_sets) + per_set * n_of_sets +
+           8 * 64;
+}
+
 cache::cache(int _size, int _block_size, int _cycles, int _assoc,
-             bool _write_alloc)
+             bool _write_alloc, bool huge_pages)
     : size(_size), block_size(_block_size), cycles(_cycles), assoc(ttp(_assoc)),
-      write_alloc(_write_alloc) {
-
-    n_of_sets = (ttp(size) / assoc) / ttp(block_size);
-    b_tag_size = B_ADDR_SIZE - block_size - my_log2(n_of_sets);
-
-    /* create n-ways, each one containing a #set of lines and tag */
-    ways =
-        std::vector<way>(assoc, way(assoc, n_of_sets, b_tag_size, block_size));
-
-    /* create an LRU queue for each set */
-    LRUs = std::vector<LRU>(n_of_sets, LRU(assoc));
+      n_of_sets((ttp(size) / assoc) / ttp(block_size)),
+      b_tag_size(B_ADDR_SIZE - block_size - my_log2(n_of_sets)),
+      write_alloc(_write_alloc),
+      arena(arena_bytes(assoc, n_of_sets), huge_pages),
+      tags(arena, assoc, n_of_sets) {
 
     /* create a mask of 111111000000... to get the tag from the address */
     tag_mask = ~((1 << (B_ADDR_SIZE - b_tag_size)) - 1);
@@ -219,257 +662,676 @@ cache::cache(int _size, int _block_size, int _cycles, int _assoc,
     // set_mask = (~((1 << (B_ADDR_SIZE - block_size)) - 1)) & (~tag_mask);
 }
 
+cache::~cache() {}
+
 tag_t cache::create_tag(addr_t address) const {
-    uint32_t tag_nr = (address & tag_mask) >> (B_ADDR_SIZE - b_tag_size);
-    return tag_t(b_tag_size, address, tag_nr);
+    return (address & tag_mask) >> (B_ADDR_SIZE - b_tag_size);
 }
 
 set_t cache::create_set(addr_t address) const {
     return (address & set_mask) >> block_size;
 }
 
-outcome cache::find_and_read_data(addr_t address) {
-    tag_t cur_tag = create_tag(address);
-    set_t cur_set = create_set(address);
+addr_t cache::create_address(tag_t tag, set_t set) const {
+    /* widen before shifting, a cache of a single huge set has no tag bits */
+    uint64_t tag_part = (uint64_t)tag << (B_ADDR_SIZE - b_tag_size);
+    return (addr_t)tag_part | (set << block_size);
+}
+
+access_result cache::probe(addr_t address) const {
+    access_result result = start_probe(address);
+    /* find the tag among the ways of the set */
+    result.way_nr = tags.find_tag(result.set, result.tag);
+    result.hit = result.way_nr != -1;
+    return result;
+}
+
+access_result cache::start_probe(addr_t address) const {
+    access_result result;
+    result.address = address;
+    result.tag = create_tag(address);
+    result.set = create_set(address);
+    result.evicted = false;
+    result.victim_address = 0;
+    result.victim_dirty = false;
+    result.victim_upper_way = -1;
+
+    result.way_nr = -1;
+    result.hit = false;
+    return result;
+}
+
+outcome cache::count_lookup(access_result &result, op_t op) {
     n_of_access++;
-    /* go thrugh the ways and find the tag in the set */
-    for (size_t way_nr = 0; way_nr < ways.size(); way_nr++) {
-        if (ways[way_nr].find_tag(cur_tag, cur_set)) {
-            n_of_hits++;
-            /* update LRU queue */
-            LRUs[cur_set].update_queue(way_nr);
-            return true;
-        }
+    if (!result.hit) {
+        n_of_misses++;
+        return false;
     }
-    n_of_misses++;
-    return false;
+
+    n_of_hits++;
+    if (op == OP_WRITE) tags.set_dirty(result.set, result.way_nr, true);
+    return true;
 }
 
-addr_t cache::find_victim(addr_t address) {
-    set_t cur_set = create_set(address);
+void cache::evict(access_result &result, int way_nr) {
+    result.evicted = true;
+    result.victim_address =
+        create_address(tags.get_tag(result.set, way_nr), result.set);
+    result.victim_dirty = tags.is_dirty(result.set, way_nr);
+    if (!upper_ways.empty()) {
+        result.victim_upper_way =
+            upper_ways[(size_t)result.set * assoc + way_nr] - 1;
+    }
+    forget_line(result.set, way_nr);
+}
 
-    /* nr == number */
-    int way_nr = find_empty_space(cur_set); /* find INVALID set */
-    if (way_nr != -1) return address;
+void cache::place(access_result &result, int way_nr, bool dirty) {
+    /* Insert a new tag */
+    tags.insert_tag(result.set, way_nr, result.tag);
+    if (dirty) tags.set_dirty(result.set, way_nr, true);
+    result.way_nr = way_nr;
+}
 
-    /* only if there is no empty space, we pick a victim, to avoid sending junk
-     * data back */
-    way_nr = get_lru_way(cur_set); /* victim */
-    return ways[way_nr].get_full_address(cur_set);
+outcome cache::invalidate(addr_t address, bool &was_dirty) {
+    set_t cur_set = create_set(address);
+    int way_nr = tags.find_tag(cur_set, create_tag(address));
+    if (way_nr == -1) return false;
+
+    was_dirty = tags.is_dirty(cur_set, way_nr);
+    tags.set_valid(cur_set, way_nr, false);
+    forget_line(cur_set, way_nr);
+    return true;
 }
 
-outcome cache::is_victim_dirty(addr_t victim_address) {
-    tag_t cur_tag = create_tag(victim_address);
-    set_t cur_set = create_set(victim_address);
-    for (size_t way_nr = 0; way_nr < ways.size(); way_nr++) {
-        if (ways[way_nr].find_tag(cur_tag, cur_set)) {
-            return ways[way_nr].is_set_dirty(cur_set);
-        }
+outcome cache::invalidate_way(addr_t address, int way_nr, bool &was_dirty,
+                              int &upper_way) {
+    set_t cur_set = create_set(address);
+    if (!tags.is_valid(cur_set, way_nr) ||
+        tags.get_tag(cur_set, way_nr) != create_tag(address)) {
+        return false;
     }
-    return false;
+
+    was_dirty = tags.is_dirty(cur_set, way_nr);
+    tags.set_valid(cur_set, way_nr, false);
+    upper_way = -1;
+    if (!upper_ways.empty()) {
+        upper_way = upper_ways[(size_t)cur_set * assoc + way_nr] - 1;
+    }
+    forget_line(cur_set, way_nr);
+    return true;
+}
+
+void cache::track_sharing() {
+    shared_ways.allocate(arena, (size_t)n_of_sets * assoc);
 }
 
-void cache::invalidate_victim(addr_t victim_address) {
-    set_validity_status(victim_address, false);
+bool cache::is_shared(const access_result &line) const {
+    if (shared_ways.empty()) return false;
+    return shared_ways[(size_t)line.set * assoc + line.way_nr];
 }
 
-void cache::dirtify_victim(addr_t victim_address) {
-    set_dirt_status(victim_address, true);
+void cache::set_shared(const access_result &line, bool shared) {
+    if (shared_ways.empty()) return;
+    shared_ways[(size_t)line.set * assoc + line.way_nr] = shared;
 }
 
-void cache::insert_new_data(addr_t address) {
-    tag_t cur_tag = create_tag(address);
+outcome cache::share(addr_t address, bool &was_dirty) {
     set_t cur_set = create_set(address);
+    int way_nr = tags.find_tag(cur_set, create_tag(address));
+    if (way_nr == -1) return false;
+
+    /* M and E both become S, the data of M is written back */
+    was_dirty = tags.is_dirty(cur_set, way_nr);
+    tags.set_dirty(cur_set, way_nr, false);
+    if (!shared_ways.empty()) shared_ways[(size_t)cur_set * assoc + way_nr] = 1;
+    return true;
+}
 
-    /* nr == number */
-    int way_nr = find_empty_space(cur_set); /* find INVALID set */
-    /* Insert a new tag */
-    ways[way_nr].insert_tag(cur_tag, cur_set);
-    /* update LRU queue */
-    LRUs[cur_set].update_queue(way_nr);
+void cache::track_presence() {
+    tags.track_presence();
 }
 
-void cache::insert_dirty_new_data(addr_t address) {
-    tag_t cur_tag = create_tag(address);
-    set_t cur_set = create_set(address);
+void cache::track_upper_ways() {
+    upper_ways.allocate(arena, (size_t)n_of_sets * assoc);
+}
 
-    /* nr == number */
-    int way_nr = find_empty_space(cur_set); /* find INVALID set */
-    /* Insert a new dirty tag */
-    ways[way_nr].insert_tag(cur_tag, cur_set);
-    ways[way_nr].set_dirt_status(cur_set, true);
-    /* update LRU queue */
-    LRUs[cur_set].update_queue(way_nr);
+void cache::set_upper_way(const access_result &line, int upper_way) {
+    if (upper_ways.empty()) return;
+    upper_ways[(size_t)line.set * assoc + line.way_nr] = upper_way + 1;
 }
 
-outcome cache::find_and_write_data(addr_t address) {
-    tag_t cur_tag = create_tag(address);
-    set_t cur_set = create_set(address);
-    n_of_access++;
-    for (size_t way_nr = 0; way_nr < ways.size(); way_nr++) {
-        if (ways[way_nr].find_tag(cur_tag, cur_set)) {
-            ways[way_nr].set_dirt_status(cur_set, true);
+void cache::track_prefetches() {
+    prefetch_ready.allocate(arena, (size_t)n_of_sets * assoc);
+    polluted_blocks.allocate(arena, (size_t)n_of_sets * assoc);
+}
 
-            /* update LRU queue */
-            LRUs[cur_set].update_queue(way_nr);
+void cache::mark_prefetch(const access_result &result, uint64_t ready_cycle) {
+    prefetch_ready[(size_t)result.set * assoc + result.way_nr] =
+        ready_cycle + 1;
+}
 
-            n_of_hits++;
-            return true;
-        }
-    }
+outcome cache::claim_prefetch(const access_result &hit,
+                              uint64_t &ready_cycle) {
+    uint64_t &ready = prefetch_ready[(size_t)hit.set * assoc + hit.way_nr];
+    if (ready == 0) return false;
+    ready_cycle = ready - 1;
+    ready = 0;
+    return true;
+}
+
+void cache::mark_polluted(addr_t block) {
+    polluted_blocks[block % ((size_t)n_of_sets * assoc)] = block + 1;
+}
+
+outcome cache::claim_polluted(addr_t block) {
+    addr_t &polluted = polluted_blocks[block % ((size_t)n_of_sets * assoc)];
+    if (polluted != block + 1) return false;
+    polluted = 0;
+    return true;
+}
 
-    n_of_misses++;
-    return false;
+void cache::forget_line(set_t set, int way_nr) {
+    size_t line = (size_t)set * assoc + way_nr;
+    if (!prefetch_ready.empty()) prefetch_ready[line] = 0;
+    if (!upper_ways.empty()) upper_ways[line] = 0;
+    if (!shared_ways.empty()) shared_ways[line] = 0;
 }
 
 int cache::find_empty_space(set_t set) const {
-    for (size_t way_nr = 0; way_nr < ways.size(); way_nr++) {
-        if (!ways[way_nr].check_set_valid(set)) return way_nr;
+    return tags.find_invalid(set);
+}
+
+void cache::merge_counters(const cache &shard) {
+    n_of_access += shard.n_of_access;
+    n_of_misses += shard.n_of_misses;
+    n_of_hits += shard.n_of_hits;
+}
+
+void cache::reset(int _cycles, bool _write_alloc) {
+    cycles = _cycles;
+    write_alloc = _write_alloc;
+    /* every way invalid and clean, and nothing tracked for any of them */
+    arena.reset();
+    n_of_access = 0;
+    n_of_misses = 0;
+    n_of_hits = 0;
+}
+
+int cache::get_cycles() const {
+    return cycles;
+}
+bool cache::get_write_alloc() const {
+    return write_alloc;
+}
+size_t cache::get_n_access() const {
+    return n_of_access;
+}
+size_t cache::get_n_hits() const {
+    return n_of_hits;
+}
+size_t cache::get_n_misses() const {
+    return n_of_misses;
+}
+
+// ---------------------------- POLICY CACHE ----------------------------  //
+
+template <class Repl, int WAYS>
+policy_cache<Repl, WAYS>::policy_cache(int _size, int _block_size,
+                                       int _cycles, int _assoc,
+                                       bool _write_alloc, uint32_t seed,
+                                       bool huge_pages)
+    : cache(_size, _block_size, _cycles, _assoc, _write_alloc, huge_pages),
+      repl(arena, assoc, n_of_sets, seed) {}
+
+template <class Repl, int WAYS>
+int policy_cache<Repl, WAYS>::find_way(set_t set, tag_t tag) const {
+    /* WAYS is a constant, so only one of them is compiled in */
+    return WAYS ? tags.find_tag_fixed<WAYS>(set, tag) : tags.find_tag(set, tag);
+}
+
+template <class Repl, int WAYS>
+access_result policy_cache<Repl, WAYS>::lookup(addr_t address, op_t op) {
+    access_result result = start_probe(address);
+    result.way_nr = find_way(result.set, result.tag);
+    result.hit = result.way_nr != -1;
+    /* update the replacement state of a hit */
+    if (count_lookup(result, op) && WAYS != 1) {
+        repl.touch(result.set, result.way_nr);
     }
+    return result;
+}
 
-    return -1;
+template <class Repl, int WAYS>
+void policy_cache<Repl, WAYS>::fill(access_result &result, bool dirty) {
+    /* nr == number */
+    int way_nr = WAYS ? tags.find_invalid_fixed<WAYS>(result.set)
+                      : find_empty_space(result.set); /* find INVALID set */
+    if (way_nr == -1) {
+        /* only if there is no empty space, we pick a victim, to avoid
+         * sending junk data back */
+        way_nr = WAYS == 1 ? 0 : repl.victim(result.set); /* victim */
+        evict(result, way_nr);
+    }
+
+    place(result, way_nr, dirty);
+    if (WAYS != 1) repl.insert(result.set, way_nr);
 }
 
-int cache::get_lru_way(set_t set) const {
-    return LRUs[set].get_lru();
+template <class Repl, int WAYS>
+outcome policy_cache<Repl, WAYS>::writeback(addr_t address) {
+    set_t cur_set = create_set(address);
+    int way_nr = find_way(cur_set, create_tag(address));
+    if (way_nr == -1) return false;
+
+    tags.set_dirty(cur_set, way_nr, true);
+    /* a write is an access, so we need to update the replacement state */
+    if (WAYS != 1) repl.touch(cur_set, way_nr);
+    return true;
 }
 
-void cache::set_dirt_status(addr_t address, bool status) {
-    tag_t cur_tag = create_tag(address);
+template <class Repl, int WAYS>
+void policy_cache<Repl, WAYS>::prefetch(addr_t address) const {
     set_t cur_set = create_set(address);
-    for (size_t way_nr = 0; way_nr < ways.size(); way_nr++) {
-        if (ways[way_nr].find_tag(cur_tag, cur_set)) {
-            ways[way_nr].set_dirt_status(cur_set, status);
+    tags.prefetch(cur_set);
+    if (WAYS != 1) repl.prefetch(cur_set);
+}
+
+template <class Repl, int WAYS>
+void policy_cache<Repl, WAYS>::reset(int _cycles, bool _write_alloc) {
+    cache::reset(_cycles, _write_alloc);
+    repl.reset();
+}
 
-            /* a write is an access, so we need to update the LRU */
-            LRUs[cur_set].update_queue(way_nr);
+typedef cache *(*cache_factory)(int size, int block_size, int cycles,
+                                int assoc, bool write_alloc, uint32_t seed,
+                                bool huge_pages);
+
+template <class Repl, int WAYS>
+static cache *build_cache(int size, int block_size, int cycles, int assoc,
+                          bool write_alloc, uint32_t seed, bool huge_pages) {
+    return new policy_cache<Repl, WAYS>(size, block_size, cycles, assoc,
+                                        write_alloc, seed, huge_pages);
+}
+
+/* the factory of the cache with the policy for 2^assoc ways, from a table of
+ * the specialized geometries */
+template <class Repl> static cache_factory pick_geometry(int assoc) {
+    static const cache_factory specialized[] = {
+        build_cache<Repl, 1>, build_cache<Repl, 2>, build_cache<Repl, 4>,
+        build_cache<Repl, 8>, build_cache<Repl, 16>};
+    static const int n_of_specialized =
+        sizeof(specialized) / sizeof(specialized[0]);
+    return assoc < n_of_specialized ? specialized[assoc]
+                                    : build_cache<Repl, 0>;
+}
+
+std::unique_ptr<cache> make_cache(int size, int block_size, int cycles,
+                                  int assoc, bool write_alloc, repl_kind repl,
+                                  lru_kind lru, uint32_t seed,
+                                  bool huge_pages) {
+    cache_factory factory = nullptr;
+    switch (repl) {
+    case REPL_LRU:
+        /* wider sets than the packed ages fit keep the queue */
+        if (lru == LRU_PACKED && ttp(assoc) <= packed_lru::MAX_ASSOC) {
+            factory = pick_geometry<packed_lru_policy>(assoc);
+        } else {
+            factory = pick_geometry<queue_lru_policy>(assoc);
         }
+        break;
+    case REPL_PLRU:
+        factory = pick_geometry<tree_plru_policy>(assoc);
+        break;
+    case REPL_SRRIP:
+        factory = pick_geometry<srrip_policy>(assoc);
+        break;
+    case REPL_BRRIP:
+        factory = pick_geometry<brrip_policy>(assoc);
+        break;
+    case REPL_FIFO:
+        factory = pick_geometry<fifo_policy>(assoc);
+        break;
+    case REPL_RANDOM:
+        factory = pick_geometry<random_policy>(assoc);
+        break;
     }
+    return std::unique_ptr<cache>(
+        factory(size, block_size, cycles, assoc, write_alloc, seed,
+                huge_pages));
 }
 
-void cache::set_validity_status(addr_t address, bool status) {
-    tag_t cur_tag = create_tag(address);
-    set_t cur_set = create_set(address);
-    for (size_t way_nr = 0; way_nr < ways.size(); way_nr++) {
-        if (ways[way_nr].find_tag(cur_tag, cur_set)) {
-            ways[way_nr].set_valid_status(cur_set, status);
+// ---------------------------- VICTIM CACHE ----------------------------  //
+
+victim_cache::victim_cache(int _block_size)
+    : block_size(_block_size),
+      arena(tag_store::bytes_needed(ENTRIES, 1), false),
+      entries(arena, ENTRIES, 1), inserted() {}
+
+outcome victim_cache::lookup(addr_t address, bool &was_dirty) {
+    n_of_access++;
+    outcome hit = take(address, was_dirty);
+    if (hit) n_of_hits++;
+    return hit;
+}
+
+outcome victim_cache::take(addr_t address, bool &was_dirty) {
+    int entry = entries.find_tag(0, address >> block_size);
+    if (entry < 0) return false;
+
+    was_dirty = entries.is_dirty(0, entry);
+    entries.set_valid(0, entry, false);
+    return true;
+}
+
+outcome victim_cache::write(addr_t address) {
+    n_of_access++;
+    int entry = entries.find_tag(0, address >> block_size);
+    if (entry < 0) return false;
+
+    n_of_hits++;
+    entries.set_dirty(0, entry, true);
+    return true;
+}
+
+outcome victim_cache::insert(addr_t address, bool dirty) {
+    int entry = entries.find_invalid(0);
+    bool pushed_dirty = false;
+    if (entry < 0) {
+        /* full, push out the oldest entry */
+        entry = 0;
+        for (int i = 1; i < ENTRIES; i++) {
+            if (inserted[i] < inserted[entry]) entry = i;
         }
+        pushed_dirty = entries.is_dirty(0, entry);
     }
+    entries.insert_tag(0, entry, address >> block_size);
+    entries.set_dirty(0, entry, dirty);
+    inserted[entry] = n_of_inserts++;
+    return pushed_dirty;
 }
 
-size_t cache::get_n_access() const {
+void victim_cache::reset() {
+    arena.reset();
+    for (int i = 0; i < ENTRIES; i++) {
+        inserted[i] = 0;
+    }
+    n_of_inserts = 0;
+    n_of_access = 0;
+    n_of_hits = 0;
+}
+
+size_t victim_cache::get_n_access() const {
     return n_of_access;
 }
-size_t cache::get_n_hits() const {
+
+size_t victim_cache::get_n_hits() const {
     return n_of_hits;
 }
-size_t cache::get_n_misses() const {
-    return n_of_misses;
+
+size_t victim_cache::get_n_misses() const {
+    return n_of_access - n_of_hits;
 }
 
-// ---------------------------- WAY ----------------------------  //
+// ---------------------------- TAG STORE ----------------------------  //
+
+tag_store::tag_store(cache_arena &arena, int _assoc, int _n_of_sets)
+    : assoc(_assoc), n_of_sets(_n_of_sets),
+      n_of_mask_words((assoc + WAYS_PER_MASK - 1) / WAYS_PER_MASK),
+      n_of_signature_words(
+          assoc >= MIN_SIGNED_WAYS && assoc <= MAX_SIGNED_WAYS ? 1 : 0),
+      set_stride(set_bytes(assoc) / sizeof(uint64_t)),
+      match_tags(select_tag_match()) {
+    /* every way starts invalid and clean */
+    blocks.allocate(arena, set_stride * n_of_sets);
+}
 
-way::way(int _assoc, int _n_of_lines, int _b_tag_size, int _block_size)
-    : assoc(_assoc), n_of_lines(_n_of_lines), b_tag_size(_b_tag_size),
-      block_size(_block_size), tags(n_of_lines, tag_t(b_tag_size)) {}
+size_t tag_store::set_bytes(int assoc) {
+    int n_of_mask_words = (assoc + WAYS_PER_MASK - 1) / WAYS_PER_MASK;
+    /* sets of fewer ways than the match kernel compares at once are
+     * searched without it and need no padding, the tags of the others are
+     * whole vectors already, as the ways are a power of two */
+    int n_of_signature_words =
+        assoc >= MIN_SIGNED_WAYS && assoc <= MAX_SIGNED_WAYS ? 1 : 0;
+    size_t needed = (2 * n_of_mask_words + n_of_signature_words) *
+                        sizeof(uint64_t) +
+                    assoc * sizeof(tag_t);
+    /* round every set up to a power of two, or to whole host lines, so no
+     * set straddles more lines than it has to */
+    if (needed > HOST_LINE_SIZE) {
+        return (needed + HOST_LINE_SIZE - 1) & ~(HOST_LINE_SIZE - 1);
+    }
+    size_t rounded = sizeof(uint64_t);
+    while (rounded < needed) rounded *= 2;
+    return rounded;
+}
 
-bool way::find_tag(tag_t tag, set_t set) const {
-    return (tags[set] == tag) && tags[set].is_valid();
+size_t tag_store::bytes_needed(int assoc, int n_of_sets) {
+    return set_bytes(assoc) * n_of_sets;
 }
 
-void way::insert_tag(tag_t tag, set_t set) {
-    tags[set].validate_and_insert(tag);
+void tag_store::prefetch(set_t set) const {
+    const size_t LINE_WORDS = HOST_LINE_SIZE / sizeof(uint64_t);
+    const uint64_t *first = &blocks[set * set_stride];
+    __builtin_prefetch(first);
+    /* a miss only reads the signature, in the first line */
+    if (presence) return;
+    for (size_t word = LINE_WORDS; word < set_stride; word += LINE_WORDS) {
+        __builtin_prefetch(first + word);
+    }
 }
 
-bool way::check_set_valid(set_t set) const {
-    return tags[set].is_valid();
+void tag_store::track_presence() {
+    /* every signature is 0 already, as every set is empty */
+    presence = n_of_signature_words > 0;
 }
 
-bool way::is_set_dirty(set_t set) const {
-    return tags[set].is_dirty();
+uint64_t tag_store::signature_bit(tag_t tag) {
+    /* the top bits of a multiplicative hash, so tags that differ only in
+     * their high bits still spread over the signature */
+    return 1ULL << ((tag * 0x9E3779B1u) >> 26);
 }
 
-void way::set_dirt_status(set_t set, bool status) {
-    tags[set].set_dirty(status);
+void tag_store::refresh_signature(set_t set) {
+    const tag_t *line = set_tags(set);
+    uint64_t bits = 0;
+    for (int way_nr = 0; way_nr < assoc; way_nr++) {
+        if (is_valid(set, way_nr)) bits |= signature_bit(line[way_nr]);
+    }
+    *signature(set) = bits;
 }
 
-void way::set_valid_status(set_t set, bool status) {
-    tags[set].set_valid(status);
+uint64_t *tag_store::valid_mask(set_t set) const {
+    return const_cast<uint64_t *>(&blocks[set * set_stride]);
 }
 
-addr_t way::get_full_address(set_t set) const {
-    return tags[set].get_full_address();
+uint64_t *tag_store::dirty_mask(set_t set) const {
+    return valid_mask(set) + n_of_mask_words;
 }
 
-// ---------------------------- TAG ----------------------------  //
+uint64_t *tag_store::signature(set_t set) const {
+    return dirty_mask(set) + n_of_mask_words;
+}
 
-tag_t::tag_t(int _b_tag_size, addr_t address, uint32_t _data)
-    : data(_data), full_address(address), b_tag_size(_b_tag_size), valid(false),
-      dirty(false) {}
+tag_t *tag_store::set_tags(set_t set) const {
+    return reinterpret_cast<tag_t *>(signature(set) + n_of_signature_words);
+}
 
-tag_t &tag_t::operator=(const tag_t &other) {
-    data = other.data;
-    full_address = other.full_address;
-    b_tag_size = other.b_tag_size;
-    valid = other.valid;
-    dirty = other.dirty;
+int tag_store::find_tag(set_t set, tag_t tag) const {
+    if (presence && !(*signature(set) & signature_bit(tag))) return -1;
+    const uint64_t *valid = valid_mask(set);
+    const tag_t *line = set_tags(set);
+    if (assoc < TAG_MATCH_LANES) {
+        /* too few ways for the kernel to load a whole vector of */
+        for (int way_nr = 0; way_nr < assoc; way_nr++) {
+            if (line[way_nr] == tag && ((valid[0] >> way_nr) & 1))
+                return way_nr;
+        }
+        return -1;
+    }
+    /* compare a whole mask word worth of ways at a time */
+    for (int word = 0; word < n_of_mask_words; word++) {
+        int first_way = word * WAYS_PER_MASK;
+        int n_of_ways = assoc - first_way < WAYS_PER_MASK ? assoc - first_way
+                                                          : WAYS_PER_MASK;
+        uint64_t hits =
+            match_tags(line + first_way, n_of_ways, tag) & valid[word];
+        if (hits) return first_way + __builtin_ctzll(hits);
+    }
+    return -1;
+}
 
-    return *this;
+template <int WAYS> int tag_store::find_tag_fixed(set_t set, tag_t tag) const {
+    static_assert(WAYS <= WAYS_PER_MASK, "one mask word holds every way");
+    /* the masks, then the signature if the set has one */
+    const int SIGNATURE_WORDS =
+        WAYS >= MIN_SIGNED_WAYS && WAYS <= MAX_SIGNED_WAYS ? 1 : 0;
+    const uint64_t *valid = &blocks[set * set_stride];
+    if (SIGNATURE_WORDS && presence && !(valid[2] & signature_bit(tag))) {
+        return -1;
+    }
+    const tag_t *line =
+        reinterpret_cast<const tag_t *>(valid + 2 + SIGNATURE_WORDS);
+    uint64_t hits = 0;
+    if (WAYS > TAG_MATCH_LANES) {
+        /* wider sets are still faster through the vector kernel */
+        hits = match_tags(line, WAYS, tag);
+    } else {
+        for (int way_nr = 0; way_nr < WAYS; way_nr++) {
+            hits |= (uint64_t)(line[way_nr] == tag) << way_nr;
+        }
+    }
+    hits &= valid[0];
+    return hits ? __builtin_ctzll(hits) : -1;
 }
 
-bool tag_t::operator==(const tag_t &other) const {
-    return data == other.data;
+template <int WAYS> int tag_store::find_invalid_fixed(set_t set) const {
+    const uint64_t *valid = &blocks[set * set_stride];
+    /* the modulo keeps the shift in range for 64 ways */
+    uint64_t ways = ~0ULL >> ((WAYS_PER_MASK - WAYS) % WAYS_PER_MASK);
+    uint64_t invalid = ~valid[0] & ways;
+    return invalid ? __builtin_ctzll(invalid) : -1;
 }
 
-/* insert and mark as valid */
-void tag_t::validate_and_insert(const tag_t &other) {
-    data = other.data;
-    full_address = other.full_address;
-    b_tag_size = other.b_tag_size;
-    valid = true;
-    dirty = false;
+int tag_store::find_invalid(set_t set) const {
+    const uint64_t *valid = valid_mask(set);
+    for (int word = 0; word < n_of_mask_words; word++) {
+        uint64_t invalid = ~valid[word];
+        if (invalid == 0) continue;
+        int way_nr = word * WAYS_PER_MASK + __builtin_ctzll(invalid);
+        /* the bits above assoc in the last word are never set */
+        return way_nr < assoc ? way_nr : -1;
+    }
+    return -1;
 }
 
-uint32_t tag_t::get_data() const {
-    return data;
+void tag_store::insert_tag(set_t set, int way_nr, tag_t tag) {
+    set_tags(set)[way_nr] = tag;
+    set_valid(set, way_nr, true);
+    set_dirty(set, way_nr, false);
 }
 
-addr_t tag_t::get_full_address() const {
-    return full_address;
+tag_t tag_store::get_tag(set_t set, int way_nr) const {
+    return set_tags(set)[way_nr];
 }
 
-bool tag_t::is_valid() const {
-    return valid;
+bool tag_store::is_valid(set_t set, int way_nr) const {
+    return (valid_mask(set)[way_nr / WAYS_PER_MASK] >>
+            (way_nr % WAYS_PER_MASK)) & 1;
 }
 
-bool tag_t::is_dirty() const {
-    return dirty;
+bool tag_store::is_dirty(set_t set, int way_nr) const {
+    return (dirty_mask(set)[way_nr / WAYS_PER_MASK] >>
+            (way_nr % WAYS_PER_MASK)) & 1;
 }
 
-void tag_t::set_data(uint32_t _data) {
-    data = _data;
+void tag_store::set_valid(set_t set, int way_nr, bool status) {
+    uint64_t bit = 1ULL << (way_nr % WAYS_PER_MASK);
+    uint64_t &word = valid_mask(set)[way_nr / WAYS_PER_MASK];
+    word = status ? (word | bit) : (word & ~bit);
+
+    /* a way that stops being valid leaves a stale bit, which is safe */
+    if (!presence || !status) return;
+    uint64_t &bits = *signature(set);
+    bits |= signature_bit(set_tags(set)[way_nr]);
+    if (__builtin_popcountll(bits) > DENSE_SIGNATURE) refresh_signature(set);
 }
 
-void tag_t::set_valid(bool state) {
-    valid = state;
+void tag_store::set_dirty(set_t set, int way_nr, bool status) {
+    uint64_t bit = 1ULL << (way_nr % WAYS_PER_MASK);
+    uint64_t &word = dirty_mask(set)[way_nr / WAYS_PER_MASK];
+    word = status ? (word | bit) : (word & ~bit);
 }
 
-void tag_t::set_dirty(bool state) {
-    dirty = state;
+// ---------------------------- ARENA ----------------------------  //
+
+cache_arena::cache_arena(size_t _capacity, bool huge_pages)
+    : capacity(_capacity) {
+    /* anonymous pages read as zero, and only the ones written get memory.
+     * Don't reserve swap for all of them up front, most are never used */
+    n_of_mapped = capacity + (huge_pages ? HUGE_PAGE_SIZE : 0);
+    void *memory = mmap(nullptr, n_of_mapped, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) throw std::bad_alloc();
+    mapping = static_cast<char *>(memory);
+    base = mapping;
+    if (!huge_pages) return;
+
+    /* start on a huge page, so the kernel can back the arena with them */
+    uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+    start = (start + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    base = reinterpret_cast<char *>(start);
+#ifdef MADV_HUGEPAGE
+    /* only a hint, without THP the arena just keeps small pages */
+    madvise(base, capacity, MADV_HUGEPAGE);
+#endif
 }
 
-// ---------------------------- TAG ----------------------------  //
+cache_arena::~cache_arena() {
+    munmap(mapping, n_of_mapped);
+}
 
-LRU::LRU(int _assoc) : assoc(_assoc), queue(assoc) {
-    for (int i = 0; i < assoc; i++) {
-        /* initialize with way i being i */
-        queue[i] = i;
+void *cache_arena::take(size_t n_of_bytes) {
+    size_t start = (n_of_used + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (start + n_of_bytes > capacity) {
+        /* shouldn't happen, the capacity covers everything a cache takes */
+        throw std::logic_error("cache arena is full");
     }
+    n_of_used = start + n_of_bytes;
+    return base + start;
 }
 
+void cache_arena::reset() {
+    /* the pages of a private anonymous mapping that are given back read as
+     * zero the next time, whatever was written to them */
+    if (n_of_used > 0) madvise(base, n_of_used, MADV_DONTNEED);
+}
+
+template <class T>
+zeroed_array<T>::zeroed_array(cache_arena &arena, size_t n_of_items) {
+    allocate(arena, n_of_items);
+}
+
+template <class T>
+void zeroed_array<T>::allocate(cache_arena &arena, size_t n_of_items) {
+    items = static_cast<T *>(arena.take(n_of_items * sizeof(T)));
+}
+
+template <class T> bool zeroed_array<T>::empty() const {
+    return items == nullptr;
+}
+
+template class zeroed_array<uint8_t>;
+template class zeroed_array<uint32_t>;
+template class zeroed_array<int>;
+template class zeroed_array<uint64_t>;
+
+// ---------------------------- LRU ----------------------------  //
+
+LRU::LRU(int _assoc) : assoc(_assoc) {}
+
 /* LRU is the one with a value of 0 in the queue */
-int LRU::get_lru() const {
-    for (size_t i = 0; i < queue.size(); i++) {
+int LRU::get_lru(const uint32_t *queue) const {
+    for (int i = 0; i < assoc; i++) {
         if (queue[i] == 0) return i;
     }
 
@@ -478,17 +1340,407 @@ int LRU::get_lru() const {
 }
 
 /* one to one copy of what is taught in class */
-void LRU::update_queue(size_t index) {
+void LRU::update_queue(uint32_t *queue, size_t index) const {
     uint32_t x = queue[index];
     queue[index] = assoc - 1;
-    for (size_t i = 0; i < queue.size(); i++) {
+    for (size_t i = 0; i < (size_t)assoc; i++) {
         if ((i != index) && (queue[i] > x)) queue[i]--;
     }
 }
 
+// ---------------------------- PACKED LRU ----------------------------  //
+
+packed_lru::packed_lru(cache_arena &arena, int _assoc, int _n_of_sets)
+    : assoc(_assoc),
+      words_per_set((assoc + WAYS_PER_WORD - 1) / WAYS_PER_WORD) {
+
+    int last_lanes = assoc - (words_per_set - 1) * WAYS_PER_WORD;
+    last_word_lanes =
+        last_lanes == WAYS_PER_WORD ? ~0ULL : ((1ULL << (8 * last_lanes)) - 1);
+
+    /* all zero, like the queue. Unused lanes stay 0: they are masked out of
+     * every update, and in a full set the zero age of a used lane is always
+     * found below them */
+    ages.allocate(arena, (size_t)words_per_set * _n_of_sets);
+}
+
+/* LRU is the one with an age of 0. A lane is 0 exactly when subtracting 1
+ * from it borrows out of its top bit, a lane above the zero one may borrow
+ * too, but the lowest hit is always the real one. */
+int packed_lru::get_lru(set_t set) const {
+    const uint64_t *words = &ages[(size_t)set * words_per_set];
+    for (int word = 0; word < words_per_set; word++) {
+        uint64_t zero = (words[word] - LOW_BITS) & ~words[word] & HIGH_BITS;
+        if (zero) return word * WAYS_PER_WORD + __builtin_ctzll(zero) / 8;
+    }
+
+    /* shouldn't happen, bubble to top */
+    throw std::logic_error("didn't find 0 element");
+}
+
+/* same as LRU::update_queue, on a word of ages at a time. Ages are below
+ * 0x80, so (age | 0x80) - (x + 1) keeps the top bit of its lane exactly when
+ * age > x, and never borrows from the next lane. */
+void packed_lru::update_queue(set_t set, int way_nr) {
+    uint64_t *words = &ages[(size_t)set * words_per_set];
+    int shift = 8 * (way_nr % WAYS_PER_WORD);
+    uint64_t &own_word = words[way_nr / WAYS_PER_WORD];
+    uint64_t x = (own_word >> shift) & 0xff;
+    if (x == (uint64_t)(assoc - 1)) return; /* already the MRU */
+
+    uint64_t threshold = (x + 1) * LOW_BITS;
+    for (int word = 0; word < words_per_set; word++) {
+        uint64_t older = ((words[word] | HIGH_BITS) - threshold) & HIGH_BITS;
+        if (word == words_per_set - 1) older &= last_word_lanes;
+        words[word] -= older >> 7;
+    }
+    own_word &= ~(0xffULL << shift);
+    own_word |= (uint64_t)(assoc - 1) << shift;
+}
+
+void packed_lru::prefetch(set_t set) const {
+    __builtin_prefetch(&ages[(size_t)set * words_per_set], 1);
+}
+
+// ---------------------------- REPLACEMENT ----------------------------  //
+
+queue_lru_policy::queue_lru_policy(cache_arena &arena, int _assoc,
+                                   int n_of_sets, uint32_t seed)
+    : assoc(_assoc), lru(_assoc), queues(arena, (size_t)n_of_sets * _assoc) {
+    (void)seed;
+}
+
+int queue_lru_policy::victim(set_t set) const {
+    return lru.get_lru(&queues[(size_t)set * assoc]);
+}
+
+void queue_lru_policy::touch(set_t set, int way_nr) {
+    lru.update_queue(&queues[(size_t)set * assoc], way_nr);
+}
+
+void queue_lru_policy::insert(set_t set, int way_nr) {
+    lru.update_queue(&queues[(size_t)set * assoc], way_nr);
+}
+
+void queue_lru_policy::prefetch(set_t set) const {
+    __builtin_prefetch(&queues[(size_t)set * assoc], 1);
+}
+
+void queue_lru_policy::reset() {}
+
+packed_lru_policy::packed_lru_policy(cache_arena &arena, int assoc,
+                                     int n_of_sets, uint32_t seed)
+    : ages(arena, assoc, n_of_sets) {
+    (void)seed;
+}
+
+int packed_lru_policy::victim(set_t set) const {
+    return ages.get_lru(set);
+}
+
+void packed_lru_policy::touch(set_t set, int way_nr) {
+    ages.update_queue(set, way_nr);
+}
+
+void packed_lru_policy::insert(set_t set, int way_nr) {
+    ages.update_queue(set, way_nr);
+}
+
+void packed_lru_policy::prefetch(set_t set) const {
+    ages.prefetch(set);
+}
+
+void packed_lru_policy::reset() {}
+
+tree_plru_policy::tree_plru_policy(cache_arena &arena, int _assoc,
+                                   int n_of_sets, uint32_t seed)
+    : assoc(_assoc), levels(my_log2(_assoc)),
+      bits(arena, (size_t)n_of_sets * _assoc) {
+    (void)seed;
+}
+
+int tree_plru_policy::victim(set_t set) const {
+    const uint8_t *tree = &bits[(size_t)set * assoc];
+    int node = 1;
+    for (int level = 0; level < levels; level++) {
+        node = 2 * node + tree[node];
+    }
+    return node - assoc;
+}
+
+void tree_plru_policy::touch(set_t set, int way_nr) {
+    uint8_t *tree = &bits[(size_t)set * assoc];
+    /* walk up from the leaf, pointing every node at the other child */
+    for (int node = way_nr + assoc; node > 1; node /= 2) {
+        tree[node / 2] = !(node & 1);
+    }
+}
+
+void tree_plru_policy::insert(set_t set, int way_nr) {
+    touch(set, way_nr);
+}
+
+void tree_plru_policy::prefetch(set_t set) const {
+    __builtin_prefetch(&bits[(size_t)set * assoc], 1);
+}
+
+void tree_plru_policy::reset() {}
+
+srrip_policy::srrip_policy(cache_arena &arena, int _assoc, int n_of_sets,
+                           uint32_t seed)
+    : assoc(_assoc), rrpv(arena, (size_t)n_of_sets * _assoc) {
+    (void)seed;
+}
+
+int srrip_policy::victim(set_t set) {
+    uint8_t *predictions = &rrpv[(size_t)set * assoc];
+    while (true) {
+        for (int way_nr = 0; way_nr < assoc; way_nr++) {
+            if (predictions[way_nr] == DISTANT) return way_nr;
+        }
+        for (int way_nr = 0; way_nr < assoc; way_nr++) {
+            predictions[way_nr]++;
+        }
+    }
+}
+
+void srrip_policy::touch(set_t set, int way_nr) {
+    rrpv[(size_t)set * assoc + way_nr] = 0;
+}
+
+void srrip_policy::insert(set_t set, int way_nr) {
+    rrpv[(size_t)set * assoc + way_nr] = DISTANT - 1;
+}
+
+void srrip_policy::prefetch(set_t set) const {
+    __builtin_prefetch(&rrpv[(size_t)set * assoc], 1);
+}
+
+void srrip_policy::reset() {}
+
+/* xorshift32, the state must not be 0 */
+static uint32_t next_random(uint32_t &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+brrip_policy::brrip_policy(cache_arena &arena, int _assoc, int n_of_sets,
+                           uint32_t _seed)
+    : srrip_policy(arena, _assoc, n_of_sets, _seed), seed(_seed ? _seed : 1),
+      random_state(seed) {}
+
+void brrip_policy::insert(set_t set, int way_nr) {
+    bool is_long = next_random(random_state) % LONG_CHANCE == 0;
+    rrpv[(size_t)set * assoc + way_nr] = is_long ? DISTANT - 1 : DISTANT;
+}
+
+void brrip_policy::reset() {
+    random_state = seed;
+}
+
+fifo_policy::fifo_policy(cache_arena &arena, int _assoc, int n_of_sets,
+                         uint32_t seed)
+    : assoc(_assoc), filled(arena, (size_t)n_of_sets * _assoc),
+      n_of_fills(arena, n_of_sets) {
+    (void)seed;
+}
+
+int fifo_policy::victim(set_t set) const {
+    const uint64_t *order = &filled[(size_t)set * assoc];
+    int oldest = 0;
+    for (int way_nr = 1; way_nr < assoc; way_nr++) {
+        if (order[way_nr] < order[oldest]) oldest = way_nr;
+    }
+    return oldest;
+}
+
+void fifo_policy::touch(set_t set, int way_nr) {
+    (void)set;
+    (void)way_nr;
+}
+
+void fifo_policy::insert(set_t set, int way_nr) {
+    filled[(size_t)set * assoc + way_nr] = n_of_fills[set]++;
+}
+
+void fifo_policy::prefetch(set_t set) const {
+    __builtin_prefetch(&filled[(size_t)set * assoc], 1);
+    __builtin_prefetch(&n_of_fills[set], 1);
+}
+
+void fifo_policy::reset() {}
+
+random_policy::random_policy(cache_arena &arena, int _assoc, int n_of_sets,
+                             uint32_t _seed)
+    : assoc(_assoc), seed(_seed ? _seed : 1), random_state(seed) {
+    (void)arena;
+    (void)n_of_sets;
+}
+
+int random_policy::victim(set_t set) {
+    (void)set;
+    /* assoc is a power of two */
+    return next_random(random_state) & (assoc - 1);
+}
+
+void random_policy::touch(set_t set, int way_nr) {
+    (void)set;
+    (void)way_nr;
+}
+
+void random_policy::insert(set_t set, int way_nr) {
+    (void)set;
+    (void)way_nr;
+}
+
+void random_policy::prefetch(set_t set) const {
+    (void)set;
+}
+
+void random_policy::reset() {
+    random_state = seed;
+}
+
+/* printf onto the end of the text */
+static void appendf(string &text, const char *format, ...) {
+    char piece[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(piece, sizeof(piece), format, args);
+    va_end(args);
+    text += piece;
+}
+
+/* format_results:
+ * The graded line, with the miss rate and coherence counts of every core
+ * when there are several, the victim cache hit rate in a sweep,
+ * where the line isn't compared against a reference, the prefetcher
+ * statistics whenever one runs, the timing model's whenever it runs, and
+ * the writebacks and bytes moved below every level with --traffic.
+ */
+static string format_results(const simulator &sim, bool sweep, bool traffic) {
+    string text;
+    double avgAccTime = sim.calc_avg_access_time();
+
+    for (size_t level_nr = 0; level_nr < sim.get_n_of_levels(); level_nr++) {
+        appendf(text, "L%dmiss=%.03f ", (int)level_nr + 1,
+                sim.calc_miss_rate(level_nr));
+    }
+    appendf(text, "AccTimeAvg=%.03f", avgAccTime);
+    for (size_t core_nr = 0;
+         sim.get_n_of_cores() > 1 && core_nr < sim.get_n_of_cores();
+         core_nr++) {
+        int name = (int)core_nr;
+        appendf(text, " C%dL1miss=%.03f", name,
+                sim.calc_core_miss_rate(core_nr));
+        appendf(text, " C%dInval=%zu", name,
+                sim.get_n_of_invalidations(core_nr));
+        appendf(text, " C%dUpgrades=%zu", name, sim.get_n_of_upgrades(core_nr));
+    }
+    if (sweep && sim.has_vic_cache()) {
+        appendf(text, " VicHit=%.03f", sim.calc_vic_hit_rate());
+    }
+    if (sim.has_prefetcher()) {
+        appendf(text, " PfAccuracy=%.03f", sim.calc_prefetch_accuracy());
+        appendf(text, " PfCoverage=%.03f", sim.calc_prefetch_coverage());
+        appendf(text, " PfTimeliness=%.03f", sim.calc_prefetch_timeliness());
+        appendf(text, " PfPollution=%.03f", sim.calc_prefetch_pollution());
+    }
+    if (sim.has_timing()) {
+        appendf(text, " Cycles=%llu",
+                (unsigned long long)sim.get_n_of_cycles());
+        appendf(text, " StallCycles=%llu",
+                (unsigned long long)sim.get_n_of_stall_cycles());
+        appendf(text, " Merged=%zu", sim.get_n_of_merged());
+        appendf(text, " MLP=%.03f", sim.calc_mlp());
+    }
+    for (size_t level_nr = 0; traffic && level_nr < sim.get_n_of_levels();
+         level_nr++) {
+        int name = (int)level_nr + 1;
+        appendf(text, " L%dWb=%zu", name, sim.get_n_writebacks(level_nr));
+        if (level_nr + 1 < sim.get_n_of_levels()) {
+            appendf(text, " L%dL%dBytes=", name, name + 1);
+        } else {
+            appendf(text, " L%dMemBytes=", name);
+        }
+        appendf(text, "%llu",
+                (unsigned long long)sim.calc_traffic_bytes(level_nr));
+    }
+    text += "\n";
+    return text;
+}
+
+/* print_miss_curves:
+ * The --stack-dist analysis: one pass over the trace gives, for every
+ * number of sets asked for, the L1 miss rate of every associativity.
+ * Writes always allocate in it, so it has to be given --wr-alloc 1.
+ */
+static int print_miss_curves(trace_source &source,
+                             const std::vector<config_flag> &flags,
+                             int block_size,
+                             const std::vector<int> &set_bits) {
+    bool write_alloc = false;
+    for (size_t i = 0; i < flags.size(); i++) {
+        if (flags[i].name != "--wr-alloc") continue;
+        write_alloc = true;
+        for (size_t value = 0; value < flags[i].values.size(); value++) {
+            if (atoi(flags[i].values[value].c_str()) == 0) write_alloc = false;
+        }
+    }
+    if (!write_alloc) {
+        cerr << "--stack-dist only models write allocate" << endl;
+        return 0;
+    }
+
+    std::vector<std::unique_ptr<stack_distance>> curves;
+    for (size_t i = 0; i < set_bits.size(); i++) {
+        if (block_size + set_bits[i] >= 31) {
+            cerr << "Error in arguments" << endl;
+            return 0;
+        }
+        curves.emplace_back(new stack_distance(block_size, set_bits[i]));
+    }
+
+    std::vector<trace_record> batch(trace_source::BATCH_SIZE);
+    size_t n_of_records;
+    while ((n_of_records = source.next_batch(batch.data(), batch.size())) > 0) {
+        for (size_t curve = 0; curve < curves.size(); curve++) {
+            for (size_t i = 0; i < n_of_records; i++) {
+                curves[curve]->access(batch[i].address);
+            }
+        }
+    }
+    if (source.bad_format()) {
+        // Operation appears in an Invalid format
+        cout << "Command Format error" << endl;
+        return 0;
+    }
+
+    for (size_t curve = 0; curve < curves.size(); curve++) {
+        int sets = curves[curve]->get_set_bits();
+        int max_assoc = curves[curve]->max_useful_assoc();
+        for (int assoc = 0; assoc <= max_assoc; assoc++) {
+            int size = block_size + sets + assoc;
+            if (size >= 31) break;
+            printf("--bsize %d --l1-size %d --l1-assoc %d L1miss=%.03f\n",
+                   block_size, size, assoc, curves[curve]->miss_rate(assoc));
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char **argv) {
 
-    if (argc < 19) {
+    /* a sweep file may hold the flags instead of the command line, and the
+     * stack distance analysis only needs a few */
+    bool short_form = false;
+    for (int i = 2; i < argc; i++) {
+        string s(argv[i]);
+        if (s == "--sweep" || s == "--stack-dist") short_form = true;
+    }
+    if (argc < 19 && !short_form) {
         cerr << "Not enough arguments" << endl;
         return 0;
     }
@@ -498,85 +1750,164 @@ int main(int argc, char **argv) {
     // File
     // Assuming it is the first argument
     char *fileString = argv[1];
-    ifstream file(fileString); // input file stream
-    string line;
-    if (!file || !file.good()) {
+    trace_reader trace(fileString); // mapped input file
+    if (!trace.good()) {
         // File doesn't exist or some other error
         cerr << "File not found" << endl;
         return 0;
     }
 
-    unsigned MemCyc = 0, BSize = 0, L1Size = 0, L2Size = 0, L1Assoc = 0,
-             L2Assoc = 0, L1Cyc = 0, L2Cyc = 0, WrAlloc = 0;
-
-    for (int i = 2; i < 19; i += 2) {
+    /* every configuration flag may be given a list ("1,2,3") or a range
+     * ("1:3") of values, the sweep is every combination of them */
+    std::vector<config_flag> flags;
+    const char *sweepFile = nullptr;
+    unsigned Pipeline = 0;
+    unsigned Threads = 1;
+    bool Traffic = false;
+    bool HugePages = false;
+    bool PresenceFilter = false;
+    std::vector<int> stackDistSets; // = log2 of the number of sets
+
+    for (int i = 2; i + 1 < argc; i += 2) {
         string s(argv[i]);
-        if (s == "--mem-cyc") {
-            MemCyc = atoi(argv[i + 1]);
-        } else if (s == "--bsize") {
-            BSize = atoi(argv[i + 1]);
-        } else if (s == "--l1-size") {
-            L1Size = atoi(argv[i + 1]);
-        } else if (s == "--l2-size") {
-            L2Size = atoi(argv[i + 1]);
-        } else if (s == "--l1-cyc") {
-            L1Cyc = atoi(argv[i + 1]);
-        } else if (s == "--l2-cyc") {
-            L2Cyc = atoi(argv[i + 1]);
-        } else if (s == "--l1-assoc") {
-            L1Assoc = atoi(argv[i + 1]);
-        } else if (s == "--l2-assoc") {
-            L2Assoc = atoi(argv[i + 1]);
-        } else if (s == "--wr-alloc") {
-            WrAlloc = atoi(argv[i + 1]);
+        if (s == "--pipeline") {
+            /* decode the trace on a thread of its own */
+            Pipeline = atoi(argv[i + 1]);
+        } else if (s == "--sweep") {
+            sweepFile = argv[i + 1];
+        } else if (s == "--stack-dist") {
+            /* L1 miss rate curves instead of a simulation */
+            if (!parse_number_list(argv[i + 1], stackDistSets)) {
+                cerr << "Error in arguments" << endl;
+                return 0;
+            }
+        } else if (s == "--traffic") {
+            /* add the writeback and memory traffic counts to the results */
+            Traffic = atoi(argv[i + 1]) != 0;
+        } else if (s == "--threads") {
+            /* run the configurations of a sweep in parallel, or shards of a
+             * single one, 0 for a thread per core */
+            Threads = atoi(argv[i + 1]);
+            if (Threads == 0) Threads = std::thread::hardware_concurrency();
+        } else if (s == "--huge-pages") {
+            /* back the caches with transparent huge pages */
+            HugePages = atoi(argv[i + 1]) != 0;
+        } else if (s == "--presence-filter") {
+            /* skip the set scans of blocks that are definitely not there */
+            PresenceFilter = atoi(argv[i + 1]) != 0;
         } else {
-            cerr << "Error in arguments" << endl;
-            return 0;
+            config_flag flag;
+            if (!parse_config_flag(s, argv[i + 1], flag)) {
+                cerr << "Error in arguments" << endl;
+                return 0;
+            }
+            flags.push_back(flag);
         }
     }
-    // unsigned MemCyc = 0, BSize = 0, L1Size = 0, L2Size = 0, L1Assoc = 0,
-    //          L2Assoc = 0, L1Cyc = 0, L2Cyc = 0, WrAlloc = 0;
-
-    /* get static reference to our sim instatiation */
-    simulator &sim = simulator::getInstance(
-        BSize, MemCyc, L1Size, L1Cyc, L1Assoc, L2Size, L2Cyc, L2Assoc, WrAlloc);
 
-    while (getline(file, line)) {
-
-        stringstream ss(line);
-        string address;
-        char operation = 0; // read (R) or write (W)
-        if (!(ss >> operation >> address)) {
-            // Operation appears in an Invalid format
-            cout << "Command Format error" << endl;
+    std::vector<sim_config> configs;
+    if (sweepFile) {
+        /* every line of the file is a grid of its own, on top of the
+         * command line */
+        std::vector<std::vector<config_flag>> lines;
+        if (!read_sweep_file(sweepFile, lines)) {
+            cerr << "Error in arguments" << endl;
             return 0;
         }
+        for (size_t line = 0; line < lines.size(); line++) {
+            std::vector<config_flag> line_flags = flags;
+            line_flags.insert(line_flags.end(), lines[line].begin(),
+                              lines[line].end());
+            expand_grid(line_flags, configs);
+        }
+    } else {
+        expand_grid(flags, configs);
+    }
+    bool sweep = sweepFile || configs.size() > 1;
+    for (size_t i = 0; i < configs.size(); i++) {
+        configs[i].huge_pages = HugePages;
+        configs[i].presence_filter = PresenceFilter;
+    }
 
-        // DEBUG - remove this line
-        // cout << "operation: " << operation;
-
-        string cutAddress =
-            address.substr(2); // Removing the "0x" part of the address
-
-        // DEBUG - remove this line
-        // cout << ", address (hex)" << cutAddress;
-
-        unsigned long int num = 0;
-        num = strtoul(cutAddress.c_str(), NULL, 16);
+    if (!stackDistSets.empty()) {
+        return print_miss_curves(trace, flags, configs[0].block_size,
+                                 stackDistSets);
+    }
 
-        // DEBUG - remove this line
-        // cout << " (dec) " << num << endl;
+    /* a sweep skips the impossible corners of its grid, a single run just
+     * refuses to start */
+    std::vector<sim_config> simulated;
+    for (size_t i = 0; i < configs.size(); i++) {
+        if (!is_valid_config(configs[i])) {
+            if (!sweep) {
+                cerr << "Error in arguments" << endl;
+                return 0;
+            }
+            cerr << "Skipping " << describe_config(configs[i]) << endl;
+            continue;
+        }
+        simulated.push_back(configs[i]);
+    }
 
-        sim.process_request(operation, num);
+    std::unique_ptr<pipelined_reader> pipeline;
+    if (Pipeline) pipeline.reset(new pipelined_reader(trace));
+    trace_source &source = pipeline ? *pipeline : (trace_source &)trace;
+
+    /* a single configuration on more threads splits into shards by its low
+     * set bits, as many as there are threads */
+    int shardBits = 0;
+    if (Threads > 1 && simulated.size() == 1) {
+        shardBits = max_shard_bits(simulated[0]);
+        while (shardBits > 0 && (1u << shardBits) > Threads)
+            shardBits--;
     }
 
-    double L1MissRate = sim.calc_L1_miss_rate();
-    double L2MissRate = sim.calc_L2_miss_rate();
-    double avgAccTime = sim.calc_avg_access_time();
+    /* decode the trace once. On one thread every batch goes to every
+     * simulator, on more the whole trace is decoded first and shared, and
+     * every thread builds the simulators it runs */
+    std::vector<string> results;
+    bool well_formed;
+    result_formatter format = [sweep, Traffic](const simulator &sim) {
+        return format_results(sim, sweep, Traffic);
+    };
+    if (shardBits > 0) {
+        simulator_list sims;
+        sim_config shard = shard_config(simulated[0], shardBits);
+        for (int i = 0; i < (1 << shardBits); i++) {
+            sims.emplace_back(new simulator(shard));
+        }
+        well_formed = replay_sharded(source, sims, simulated[0].block_size,
+                                     shardBits);
+        for (size_t i = 1; well_formed && i < sims.size(); i++) {
+            sims[0]->merge(*sims[i]);
+        }
+        if (well_formed) results.push_back(format(*sims[0]));
+    } else if (Threads > 1 && simulated.size() > 1) {
+        std::vector<trace_record> decoded;
+        well_formed = read_whole_trace(source, decoded);
+        if (well_formed) {
+            replay_parallel(decoded, simulated, Threads, format, results);
+        }
+    } else {
+        simulator_list sims;
+        for (size_t i = 0; i < simulated.size(); i++) {
+            sims.emplace_back(new simulator(simulated[i]));
+        }
+        well_formed = replay_one_pass(source, sims);
+        for (size_t i = 0; well_formed && i < sims.size(); i++) {
+            results.push_back(format(*sims[i]));
+        }
+    }
+    if (!well_formed) {
+        // Operation appears in an Invalid format
+        cout << "Command Format error" << endl;
+        return 0;
+    }
 
-    printf("L1miss=%.03f ", L1MissRate);
-    printf("L2miss=%.03f ", L2MissRate);
-    printf("AccTimeAvg=%.03f\n", avgAccTime);
+    for (size_t sim_nr = 0; sim_nr < results.size(); sim_nr++) {
+        if (sweep) printf("%s ", describe_config(simulated[sim_nr]).c_str());
+        printf("%s", results[sim_nr].c_str());
+    }
 
     return 0;
 }
@@ -0,0 +1,352 @@
+#include "config.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+using std::string;
+using std::vector;
+
+// ---------------------------- HELPER FUNCTIONS ---------------------------- //
+
+/* the numeric flags, and where each goes in the configuration */
+static const std::map<string, int sim_config::*> &numeric_flags() {
+    static const std::map<string, int sim_config::*> flags = {
+        {"--mem-cyc", &sim_config::mem_cycles},
+        {"--bsize", &sim_config::block_size},
+        {"--wb-cyc", &sim_config::wb_cycles},
+        {"--seed", &sim_config::seed},
+        {"--prefetch-level", &sim_config::prefetch_level},
+        {"--prefetch-degree", &sim_config::prefetch_degree},
+        {"--issue-width", &sim_config::issue_width},
+        {"--cores", &sim_config::n_of_cores},
+    };
+    return flags;
+}
+
+/* the numeric flags of a level, "--l<N>-size" and so on, and where each goes
+ * in the level */
+static const std::map<string, int level_config::*> &level_flags() {
+    static const std::map<string, int level_config::*> flags = {
+        {"size", &level_config::size},
+        {"cyc", &level_config::cycles},
+        {"assoc", &level_config::assoc},
+        {"wr-alloc", &level_config::write_alloc},
+        {"mshrs", &level_config::mshrs},
+    };
+    return flags;
+}
+
+/* the names of the replacement policies, in repl_kind order */
+static const char *const repl_names[] = {"lru",   "plru", "srrip",
+                                         "brrip", "fifo", "random"};
+
+/* the names of the inclusion policies, in inclusion_kind order */
+static const char *const inclusion_names[] = {"inclusive", "nine",
+                                              "exclusive"};
+
+/* a whole, non negative decimal number */
+static bool parse_number(const string &text, int &number) {
+    if (text.empty() || text.size() > 9) return false;
+    number = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] < '0' || text[i] > '9') return false;
+        number = number * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+/* split a "--l<N>-<field>" flag, N counting the levels from 1 */
+static bool split_level_flag(const string &name, int &level_nr,
+                             string &field) {
+    if (name.compare(0, 3, "--l") != 0) return false;
+    size_t dash = name.find('-', 3);
+    if (dash == string::npos ||
+        !parse_number(name.substr(3, dash - 3), level_nr) || level_nr < 1 ||
+        level_nr > sim_config::MAX_LEVELS) {
+        return false;
+    }
+    level_nr--;
+    field = name.substr(dash + 1);
+    return true;
+}
+
+/* set a single value of a level flag, a flag of a level below the last one
+ * adds the levels down to it */
+static bool apply_level_flag(sim_config &config, int level_nr,
+                             const string &field, const string &value) {
+    level_config &level = config.levels[level_nr];
+    std::map<string, int level_config::*>::const_iterator numeric =
+        level_flags().find(field);
+    if (numeric != level_flags().end()) {
+        if (!parse_number(value, level.*(numeric->second))) return false;
+    } else if (field == "repl") {
+        int kind = REPL_LRU;
+        while (kind <= REPL_RANDOM && value != repl_names[kind]) kind++;
+        if (kind > REPL_RANDOM) return false;
+        level.repl = (repl_kind)kind;
+    } else {
+        return false;
+    }
+    if (config.n_of_levels <= level_nr) config.n_of_levels = level_nr + 1;
+    return true;
+}
+
+/* set a single value of a flag in the configuration */
+static bool apply_flag(sim_config &config, const string &name,
+                       const string &value) {
+    std::map<string, int sim_config::*>::const_iterator numeric =
+        numeric_flags().find(name);
+    if (numeric != numeric_flags().end()) {
+        return parse_number(value, config.*(numeric->second));
+    }
+
+    if (name == "--wr-alloc") {
+        int write_alloc;
+        if (!parse_number(value, write_alloc)) return false;
+        config.write_alloc = write_alloc != 0;
+        return true;
+    }
+    if (name == "--vic-cache") {
+        int vic_cache;
+        if (!parse_number(value, vic_cache)) return false;
+        config.vic_cache = vic_cache != 0;
+        return true;
+    }
+    int level_nr;
+    string field;
+    if (split_level_flag(name, level_nr, field)) {
+        return apply_level_flag(config, level_nr, field, value);
+    }
+    if (name == "--prefetch") {
+        if (value == "none") {
+            config.prefetch = PREFETCH_NONE;
+        } else if (value == "next-line") {
+            config.prefetch = PREFETCH_NEXT_LINE;
+        } else if (value == "stride") {
+            config.prefetch = PREFETCH_STRIDE;
+        } else if (value == "stream") {
+            config.prefetch = PREFETCH_STREAM;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    if (name == "--inclusion") {
+        int kind = INCL_INCLUSIVE;
+        while (kind <= INCL_EXCLUSIVE && value != inclusion_names[kind]) {
+            kind++;
+        }
+        if (kind > INCL_EXCLUSIVE) return false;
+        config.inclusion = (inclusion_kind)kind;
+        return true;
+    }
+    if (name == "--lru") {
+        /* both pick the same victims, queue is the reference to diff the
+         * packed one against */
+        if (value == "packed") {
+            config.lru = LRU_PACKED;
+        } else if (value == "queue") {
+            config.lru = LRU_QUEUE;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+/* split a comma separated list, expanding the "first:last" ranges */
+static void split_values(const string &text, vector<string> &values) {
+    std::stringstream items(text);
+    string item;
+    while (getline(items, item, ',')) {
+        size_t colon = item.find(':');
+        int first, last;
+        if (colon != string::npos &&
+            parse_number(item.substr(0, colon), first) &&
+            parse_number(item.substr(colon + 1), last) && first <= last) {
+            for (int value = first; value <= last; value++) {
+                values.push_back(std::to_string(value));
+            }
+        } else {
+            values.push_back(item);
+        }
+    }
+}
+
+// ---------------------------- CONFIGURATIONS ----------------------------  //
+
+bool parse_config_flag(const string &name, const string &text,
+                       config_flag &flag) {
+    flag.name = name;
+    flag.values.clear();
+
+    split_values(text, flag.values);
+    if (flag.values.empty()) return false;
+
+    /* check every value now, so a bad one is reported before any work */
+    sim_config scratch;
+    for (size_t i = 0; i < flag.values.size(); i++) {
+        if (!apply_flag(scratch, name, flag.values[i])) return false;
+    }
+    return true;
+}
+
+bool parse_number_list(const string &text, vector<int> &numbers) {
+    vector<string> values;
+    split_values(text, values);
+    numbers.resize(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        if (!parse_number(values[i], numbers[i])) return false;
+    }
+    return !numbers.empty();
+}
+
+void expand_grid(const vector<config_flag> &flags,
+                 vector<sim_config> &configs) {
+    vector<sim_config> grid(1);
+    for (size_t flag_nr = 0; flag_nr < flags.size(); flag_nr++) {
+        const config_flag &flag = flags[flag_nr];
+        vector<sim_config> expanded;
+        for (size_t i = 0; i < grid.size(); i++) {
+            for (size_t value = 0; value < flag.values.size(); value++) {
+                sim_config config = grid[i];
+                apply_flag(config, flag.name, flag.values[value]);
+                expanded.push_back(config);
+            }
+        }
+        grid.swap(expanded);
+    }
+    configs.insert(configs.end(), grid.begin(), grid.end());
+}
+
+bool read_sweep_file(const char *path, vector<vector<config_flag>> &lines) {
+    std::ifstream file(path);
+    if (!file) return false;
+
+    string line;
+    while (getline(file, line)) {
+        std::stringstream tokens(line);
+        string name, text;
+        vector<config_flag> flags;
+        while (tokens >> name) {
+            if (name[0] == '#') break;
+            config_flag flag;
+            if (!(tokens >> text) || !parse_config_flag(name, text, flag))
+                return false;
+            flags.push_back(flag);
+        }
+        if (!flags.empty()) lines.push_back(flags);
+    }
+    return true;
+}
+
+bool is_valid_config(const sim_config &config) {
+    for (int level_nr = 0; level_nr < config.n_of_levels; level_nr++) {
+        const level_config &level = config.levels[level_nr];
+        if (config.block_size + level.assoc > level.size || level.size >= 31 ||
+            level.mshrs < 1) {
+            return false;
+        }
+    }
+    /* the private L1s of several cores are kept coherent over inclusive or
+     * NINE shared levels, and only those are prefetched into */
+    if (config.n_of_cores < 1 || config.n_of_cores > sim_config::MAX_CORES) {
+        return false;
+    }
+    if (config.n_of_cores > 1 &&
+        (config.inclusion == INCL_EXCLUSIVE ||
+         (config.prefetch != PREFETCH_NONE && config.prefetch_level == 1))) {
+        return false;
+    }
+    /* an exclusive hierarchy moves every block up to L1, so only prefetches
+     * into L1 fit it */
+    return config.prefetch == PREFETCH_NONE ||
+           (config.prefetch_level >= 1 &&
+            config.prefetch_level <= config.n_of_levels &&
+            config.prefetch_degree >= 1 &&
+            (config.inclusion != INCL_EXCLUSIVE || config.prefetch_level == 1));
+}
+
+int max_shard_bits(const sim_config &config) {
+    if (config.vic_cache || config.prefetch != PREFETCH_NONE ||
+        config.issue_width) {
+        return 0;
+    }
+    int shard_bits = 31;
+    for (int level_nr = 0; level_nr < config.n_of_levels; level_nr++) {
+        const level_config &level = config.levels[level_nr];
+        if (level.repl == REPL_RANDOM || level.repl == REPL_BRRIP) return 0;
+        int set_bits = level.size - config.block_size - level.assoc;
+        if (set_bits < shard_bits) shard_bits = set_bits;
+    }
+    return shard_bits;
+}
+
+sim_config shard_config(const sim_config &config, int shard_bits) {
+    sim_config shard = config;
+    for (int level_nr = 0; level_nr < config.n_of_levels; level_nr++) {
+        shard.levels[level_nr].size -= shard_bits;
+    }
+    return shard;
+}
+
+string describe_config(const sim_config &config) {
+    std::stringstream text;
+    text << "--mem-cyc " << config.mem_cycles << " --bsize "
+         << config.block_size << " --wr-alloc " << config.write_alloc;
+    for (int level_nr = 0; level_nr < config.n_of_levels; level_nr++) {
+        const level_config &level = config.levels[level_nr];
+        string flag = " --l" + std::to_string(level_nr + 1);
+        text << flag << "-size " << level.size << flag << "-assoc "
+             << level.assoc << flag << "-cyc " << level.cycles;
+    }
+    if (config.wb_cycles) text << " --wb-cyc " << config.wb_cycles;
+    if (config.vic_cache) text << " --vic-cache 1";
+    if (config.inclusion != INCL_INCLUSIVE) {
+        text << " --inclusion " << inclusion_names[config.inclusion];
+    }
+    if (config.lru != LRU_PACKED) text << " --lru queue";
+    for (int level_nr = 0; level_nr < config.n_of_levels; level_nr++) {
+        const level_config &level = config.levels[level_nr];
+        string flag = " --l" + std::to_string(level_nr + 1);
+        if (level.write_alloc >= 0) {
+            text << flag << "-wr-alloc " << level.write_alloc;
+        }
+        if (level.repl != REPL_LRU) {
+            text << flag << "-repl " << repl_names[level.repl];
+        }
+        if (level.mshrs != 1) text << flag << "-mshrs " << level.mshrs;
+    }
+    if (config.seed != 1) text << " --seed " << config.seed;
+    if (config.prefetch != PREFETCH_NONE) {
+        static const char *const kinds[] = {"none", "next-line", "stride",
+                                            "stream"};
+        text << " --prefetch " << kinds[config.prefetch]
+             << " --prefetch-level " << config.prefetch_level
+             << " --prefetch-degree " << config.prefetch_degree;
+    }
+    if (config.issue_width) text << " --issue-width " << config.issue_width;
+    if (config.n_of_cores != 1) text << " --cores " << config.n_of_cores;
+    return text.str();
+}
+
+string describe_geometry(const sim_config &config) {
+    /* what a reset may change, the same for every configuration */
+    sim_config geometry = config;
+    geometry.mem_cycles = 0;
+    geometry.wb_cycles = 0;
+    geometry.write_alloc = false;
+    geometry.issue_width = 0;
+    for (int level_nr = 0; level_nr < sim_config::MAX_LEVELS; level_nr++) {
+        geometry.levels[level_nr].cycles = 0;
+        geometry.levels[level_nr].write_alloc = -1;
+        geometry.levels[level_nr].mshrs = 1;
+    }
+    string text = describe_config(geometry);
+    if (config.huge_pages) text += " --huge-pages 1";
+    if (config.presence_filter) text += " --presence-filter 1";
+    return text;
+}
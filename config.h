@@ -0,0 +1,81 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+
+#include "cache.h"
+
+/* config_flag:
+ * A configuration flag of the command line (or of a sweep file) with every
+ * value it was given. "--l1-assoc 0,2:4" has the values 0, 2, 3 and 4.
+ */
+struct config_flag {
+    std::string name;
+    std::vector<std::string> values;
+};
+
+/* parse_config_flag:
+ * Split the text of a flag into its values, a comma separated list where
+ * numbers may also be inclusive "first:last" ranges. Return false if the flag
+ * isn't a configuration flag or one of the values isn't valid for it.
+ */
+bool parse_config_flag(const std::string &name, const std::string &text,
+                       config_flag &flag);
+
+/* parse_number_list:
+ * Parse a list of numbers in the same syntax, for flags that aren't part of
+ * a configuration.
+ */
+bool parse_number_list(const std::string &text, std::vector<int> &numbers);
+
+/* expand_grid:
+ * Append a configuration for every combination of the values of the flags.
+ * A flag given more than once keeps its last values.
+ */
+void expand_grid(const std::vector<config_flag> &flags,
+                 std::vector<sim_config> &configs);
+
+/* read_sweep_file:
+ * Read a sweep file, a line of configuration flags per grid. Blank lines and
+ * lines starting with '#' are skipped. Return false on a malformed line.
+ */
+bool read_sweep_file(const char *path,
+                     std::vector<std::vector<config_flag>> &lines);
+
+/* is_valid_config:
+ * Check that every level has at least one set and one MSHR, and that a
+ * prefetcher has a level to fill, one the inclusion policy can prefetch
+ * into, and fetches at least a block ahead.
+ */
+bool is_valid_config(const sim_config &config);
+
+/* max_shard_bits:
+ * How many low set index bits the configuration can be split on, into
+ * shards that share nothing and together count the same as one run. The
+ * set index bits start at the same address bit in every level, since the
+ * block size is shared, so any of them that every level has split the whole
+ * hierarchy. 0 if something in it sees more than one set: the victim cache,
+ * a prefetcher, the timing model, or random or BRRIP replacement.
+ */
+int max_shard_bits(const sim_config &config);
+
+/* shard_config:
+ * The configuration of one of the 2^shard_bits shards: every level with as
+ * many fewer sets, for the addresses with the shard bits taken out.
+ */
+sim_config shard_config(const sim_config &config, int shard_bits);
+
+/* describe_config:
+ * The configuration as the flags that would give it.
+ */
+std::string describe_config(const sim_config &config);
+
+/* describe_geometry:
+ * The configuration without its cycles, write allocation and timing model,
+ * which take no memory of the caches, but with the host settings. A
+ * simulator can be reset for any configuration of the same geometry.
+ */
+std::string describe_geometry(const sim_config &config);
+
+#endif
@@ -0,0 +1,116 @@
+#include "prefetch.h"
+
+// ---------------------------- NEXT LINE ----------------------------  //
+
+next_line_prefetcher::next_line_prefetcher(int _degree) : degree(_degree) {}
+
+void next_line_prefetcher::observe(addr_t block, outcome hit, bool first_use,
+                                   std::vector<addr_t> &prefetches) {
+    if (hit && !first_use) return;
+    for (int ahead = 1; ahead <= degree; ahead++) {
+        prefetches.push_back(block + ahead);
+    }
+}
+
+// ---------------------------- STRIDE ----------------------------  //
+
+stride_prefetcher::stride_prefetcher(int _block_size, int _degree)
+    : block_size(_block_size), degree(_degree), table() {}
+
+void stride_prefetcher::observe(addr_t block, outcome hit, bool first_use,
+                                std::vector<addr_t> &prefetches) {
+    (void)hit;
+    (void)first_use;
+    int region_shift = REGION_BITS > block_size ? REGION_BITS - block_size : 0;
+    addr_t region = block >> region_shift;
+    /* hash the region, so that regions a power of two apart don't all fight
+     * over the same entry */
+    stride_entry &entry =
+        table[(uint32_t)(region * 0x9E3779B1u) >> (32 - TABLE_BITS)];
+
+    if (!entry.valid || entry.region != region) {
+        entry.region = region;
+        entry.last_block = block;
+        entry.stride = 0;
+        entry.confidence = 0;
+        entry.valid = true;
+        return;
+    }
+
+    int64_t stride = (int64_t)block - (int64_t)entry.last_block;
+    if (stride == 0) return;
+    if (stride == entry.stride) {
+        if (entry.confidence < CONFIRMED) entry.confidence++;
+    } else {
+        entry.stride = stride;
+        entry.confidence = 0;
+    }
+    entry.last_block = block;
+
+    if (entry.confidence < CONFIRMED) return;
+    for (int ahead = 1; ahead <= degree; ahead++) {
+        prefetches.push_back((addr_t)(block + ahead * stride));
+    }
+}
+
+// ---------------------------- STREAM ----------------------------  //
+
+stream_prefetcher::stream_prefetcher(int _depth)
+    : depth(_depth), streams() {}
+
+void stream_prefetcher::observe(addr_t block, outcome hit, bool first_use,
+                                std::vector<addr_t> &prefetches) {
+    (void)first_use;
+    n_of_observed++;
+
+    /* inside the window of a stream: top it back up to depth blocks ahead */
+    for (int i = 0; i < N_OF_STREAMS; i++) {
+        stream &current = streams[i];
+        if (!current.valid) continue;
+        if (block >= current.next_block ||
+            current.next_block - block > (addr_t)depth) {
+            continue;
+        }
+        current.last_use = n_of_observed;
+        for (; current.next_block <= block + depth; current.next_block++) {
+            prefetches.push_back(current.next_block);
+        }
+        return;
+    }
+    if (hit) return;
+
+    /* a miss outside the streams replaces the least recently used one */
+    int victim = 0;
+    for (int i = 0; i < N_OF_STREAMS; i++) {
+        if (!streams[i].valid) {
+            victim = i;
+            break;
+        }
+        if (streams[i].last_use < streams[victim].last_use) victim = i;
+    }
+    stream &fresh = streams[victim];
+    fresh.valid = true;
+    fresh.last_use = n_of_observed;
+    for (fresh.next_block = block + 1; fresh.next_block <= block + depth;
+         fresh.next_block++) {
+        prefetches.push_back(fresh.next_block);
+    }
+}
+
+// ---------------------------- FACTORY ----------------------------  //
+
+std::unique_ptr<prefetcher> make_prefetcher(prefetch_kind kind, int block_size,
+                                            int degree) {
+    switch (kind) {
+    case PREFETCH_NEXT_LINE:
+        return std::unique_ptr<prefetcher>(new next_line_prefetcher(degree));
+    case PREFETCH_STRIDE:
+        return std::unique_ptr<prefetcher>(
+            new stride_prefetcher(block_size, degree));
+    case PREFETCH_STREAM:
+        return std::unique_ptr<prefetcher>(new stream_prefetcher(degree));
+    case PREFETCH_NONE:
+        break;
+    }
+    return std::unique_ptr<prefetcher>();
+}
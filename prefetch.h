@@ -0,0 +1,104 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "cache.h"
+
+/* prefetcher:
+ * A hardware prefetcher of one cache level. It sees every demand access to
+ * the level, as a block number (the address without its offset bits),
+ * whether it hit and whether it was the first use of a prefetched block, and
+ * answers with the blocks to bring in ahead of time.
+ * The simulator fills them into the level without counting them as demand
+ * accesses, and skips the ones already there.
+ */
+class prefetcher {
+  public:
+    virtual ~prefetcher() {}
+
+    virtual void observe(addr_t block, outcome hit, bool first_use,
+                         std::vector<addr_t> &prefetches) = 0;
+};
+
+/* next_line_prefetcher:
+ * Tagged next line: on every miss, and on the first use of a prefetched
+ * block, fetch the next degree blocks.
+ */
+class next_line_prefetcher : public prefetcher {
+    int degree;
+
+  public:
+    explicit next_line_prefetcher(int _degree);
+
+    void observe(addr_t block, outcome hit, bool first_use,
+                 std::vector<addr_t> &prefetches) override;
+};
+
+/* stride_prefetcher:
+ * The trace has no program counters, so strides are learned per region of
+ * memory (4 KiB) instead of per instruction. A direct mapped table entry
+ * remembers the last block and stride seen in its region. Once the same
+ * stride shows up twice in a row, every access in the region fetches the
+ * next degree blocks along it.
+ */
+class stride_prefetcher : public prefetcher {
+    static constexpr int TABLE_BITS = 6;
+    static constexpr int REGION_BITS = 12;
+    static constexpr int CONFIRMED = 2;
+
+    struct stride_entry {
+        addr_t region;
+        addr_t last_block;
+        int64_t stride;
+        int confidence;
+        bool valid;
+    };
+
+    int block_size;
+    int degree;
+    stride_entry table[1 << TABLE_BITS];
+
+  public:
+    stride_prefetcher(int _block_size, int _degree);
+
+    void observe(addr_t block, outcome hit, bool first_use,
+                 std::vector<addr_t> &prefetches) override;
+};
+
+/* stream_prefetcher:
+ * Jouppi's stream buffers, filling into the cache: a miss outside every
+ * stream starts a new one in place of the least recently used, which
+ * fetches the next depth blocks. An access inside the window of a stream
+ * moves the window up, so the stream stays depth blocks ahead of its use.
+ */
+class stream_prefetcher : public prefetcher {
+    static constexpr int N_OF_STREAMS = 4;
+
+    struct stream {
+        addr_t next_block; // = first block not prefetched yet
+        uint64_t last_use;
+        bool valid;
+    };
+
+    int depth;
+    stream streams[N_OF_STREAMS];
+    uint64_t n_of_observed = 0;
+
+  public:
+    explicit stream_prefetcher(int _depth);
+
+    void observe(addr_t block, outcome hit, bool first_use,
+                 std::vector<addr_t> &prefetches) override;
+};
+
+/* make_prefetcher:
+ * The prefetcher of the kind, or none for PREFETCH_NONE. degree is how many
+ * blocks ahead it fetches.
+ */
+std::unique_ptr<prefetcher> make_prefetcher(prefetch_kind kind, int block_size,
+                                            int degree);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+
+/* spsc_ring:
+ * Lock-free ring of CAPACITY slots between exactly one producer thread and
+ * one consumer thread. Slots are filled and drained in place: the producer
+ * gets a free slot with begin_push, fills it and publishes it with end_push,
+ * the consumer reads the oldest slot from front and frees it with pop.
+ * Neither side ever blocks, a full or empty ring just returns nullptr.
+ */
+template <class T, size_t CAPACITY> class spsc_ring {
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0,
+                  "the capacity of the ring must be a power of 2");
+
+    static constexpr size_t HOST_LINE_SIZE = 64;
+
+    /* each index on its own host line, so the two threads don't share one.
+     * Padded rather than aligned, so the ring can be allocated with new */
+    std::atomic<size_t> head; // = next slot to pop
+    char head_padding[HOST_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail; // = next slot to push
+    char tail_padding[HOST_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+    T slots[CAPACITY];
+
+  public:
+    spsc_ring() : head(0), tail(0) {}
+
+    spsc_ring(const spsc_ring &) = delete;
+    spsc_ring &operator=(const spsc_ring &) = delete;
+
+    /* producer side */
+    T *begin_push() {
+        size_t cur_tail = tail.load(std::memory_order_relaxed);
+        if (cur_tail - head.load(std::memory_order_acquire) == CAPACITY)
+            return nullptr;
+        return &slots[cur_tail & (CAPACITY - 1)];
+    }
+
+    void end_push() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    }
+
+    /* consumer side */
+    T *front() {
+        size_t cur_head = head.load(std::memory_order_relaxed);
+        if (cur_head == tail.load(std::memory_order_acquire)) return nullptr;
+        return &slots[cur_head & (CAPACITY - 1)];
+    }
+
+    void pop() {
+        head.store(head.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    }
+};
+
+#endif
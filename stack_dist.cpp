@@ -0,0 +1,90 @@
+#include "stack_dist.h"
+
+stack_distance::stack_distance(int _block_size, int _set_bits)
+    : block_size(_block_size), set_bits(_set_bits), sets(1ULL << set_bits) {}
+
+void stack_distance::add(set_stack &stack, uint32_t time, int32_t delta) {
+    for (; time < stack.tree.size(); time += time & -time) {
+        stack.tree[time] += delta;
+    }
+}
+
+uint32_t stack_distance::prefix(const set_stack &stack, uint32_t time) {
+    uint32_t sum = 0;
+    for (; time > 0; time -= time & -time) {
+        sum += stack.tree[time];
+    }
+    return sum;
+}
+
+void stack_distance::compact(set_stack &stack) {
+    /* the marks keep their order, so the distances don't change */
+    std::vector<uint32_t> owner(1);
+    for (uint32_t time = 1; time < stack.next_time; time++) {
+        if (prefix(stack, time) - prefix(stack, time - 1) == 0) continue;
+        owner.push_back(stack.owner[time]);
+        last_time[stack.owner[time]] = owner.size() - 1;
+    }
+
+    size_t capacity = 2 * owner.size() + 16;
+    owner.resize(capacity);
+    stack.owner.swap(owner);
+    stack.next_time = stack.n_of_blocks + 1;
+
+    /* every mark is a 1, build the tree in linear time */
+    stack.tree.assign(capacity, 0);
+    for (uint32_t time = 1; time < capacity; time++) {
+        if (time < stack.next_time) stack.tree[time]++;
+        uint32_t parent = time + (time & -time);
+        if (parent < capacity) stack.tree[parent] += stack.tree[time];
+    }
+}
+
+void stack_distance::access(addr_t address) {
+    uint32_t block = address >> block_size;
+    set_stack &stack = sets[block & ((1ULL << set_bits) - 1)];
+    n_of_access++;
+
+    if (stack.next_time >= stack.tree.size()) compact(stack);
+    uint32_t now = stack.next_time++;
+
+    std::unordered_map<uint32_t, uint32_t>::iterator last =
+        last_time.find(block);
+    if (last == last_time.end()) {
+        n_of_cold_misses++;
+        stack.n_of_blocks++;
+        last_time.emplace(block, now);
+    } else {
+        /* the marks after the last one of the block are the distinct blocks
+         * used since */
+        uint32_t distance = stack.n_of_blocks - prefix(stack, last->second);
+        if (distance >= histogram.size()) histogram.resize(distance + 1);
+        histogram[distance]++;
+
+        add(stack, last->second, -1);
+        last->second = now;
+    }
+    add(stack, now, 1);
+    stack.owner[now] = block;
+}
+
+double stack_distance::miss_rate(int assoc) const {
+    uint64_t ways = 1ULL << assoc;
+    uint64_t n_of_hits = 0;
+    for (size_t distance = 0; distance < histogram.size() && distance < ways;
+         distance++) {
+        n_of_hits += histogram[distance];
+    }
+    return (double)(n_of_access - n_of_hits) / (double)n_of_access;
+}
+
+int stack_distance::max_useful_assoc() const {
+    int assoc = 0;
+    while ((1ULL << assoc) < histogram.size())
+        assoc++;
+    return assoc;
+}
+
+int stack_distance::get_set_bits() const {
+    return set_bits;
+}
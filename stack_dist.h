@@ -0,0 +1,68 @@
+#ifndef STACK_DIST_H
+#define STACK_DIST_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.h"
+
+/* stack_distance:
+ * Mattson's stack algorithm for the L1 of a given block size and number of
+ * sets. The stack distance of an access is the number of distinct blocks of
+ * its set used since the last access to its block. An LRU set of 2^a ways
+ * hits exactly the accesses at distance below 2^a, so one pass over the
+ * trace gives the miss rate of every associativity, and so of every size
+ * with this many sets.
+ *
+ * The distances are counted with a Fenwick tree per set over the times of
+ * its accesses, where only the last access of every block is marked, so an
+ * access costs O(log) of the accesses to its set.
+ *
+ * This is an L1 on its own that allocates on every miss: it matches the
+ * L1 of the simulator with write allocate, as long as L2 never drops a
+ * block that is still in L1. Without write allocate the contents of the
+ * different associativities are no longer nested, and no stack algorithm
+ * applies.
+ */
+class stack_distance {
+    /* the marked accesses of one set */
+    struct set_stack {
+        std::vector<uint32_t> tree;   // = Fenwick tree of the marks, 1 based
+        std::vector<uint32_t> owner;  // = block marked at each time
+        uint32_t next_time = 1;
+        uint32_t n_of_blocks = 0;     // = marks in the tree
+    };
+
+    int block_size;
+    int set_bits;
+
+    std::vector<set_stack> sets;
+    std::unordered_map<uint32_t, uint32_t> last_time; // block -> its mark
+
+    std::vector<uint64_t> histogram; // = accesses per stack distance
+    uint64_t n_of_cold_misses = 0;
+    uint64_t n_of_access = 0;
+
+  private:
+    static void add(set_stack &stack, uint32_t time, int32_t delta);
+    static uint32_t prefix(const set_stack &stack, uint32_t time);
+    /* renumber the marks of the set 1..n and give it room to grow */
+    void compact(set_stack &stack);
+
+  public:
+    stack_distance(int _block_size, int _set_bits);
+
+    void access(addr_t address);
+
+    /* miss rate of an L1 of 2^assoc ways with this many sets */
+    double miss_rate(int assoc) const;
+
+    /* the smallest associativity (log2) past which the miss rate stays put,
+     * since every access left missing is a first touch */
+    int max_useful_assoc() const;
+
+    int get_set_bits() const;
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include "sweep.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "config.h"
+#include "spsc_ring.h"
+
+// ---------------------------- HELPER FUNCTIONS ---------------------------- //
+
+/* work_queue:
+ * The configurations a thread has left to run. The owner takes from the front,
+ * thieves from the back.
+ */
+class work_queue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+
+  public:
+    void push(size_t job) {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.push_back(job);
+    }
+
+    bool take(size_t &job) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (jobs.empty()) return false;
+        job = jobs.front();
+        jobs.pop_front();
+        return true;
+    }
+
+    bool steal(size_t &job) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (jobs.empty()) return false;
+        job = jobs.back();
+        jobs.pop_back();
+        return true;
+    }
+};
+
+/* run_config:
+ * Replay the trace through the configuration, on the simulator of the last
+ * one if it has the same geometry, and keep its results.
+ */
+static void run_config(std::unique_ptr<simulator> &sim,
+                       const std::vector<trace_record> &trace,
+                       const sim_config &config, const result_formatter &format,
+                       std::string &result) {
+    if (sim && describe_geometry(sim->get_config()) ==
+                   describe_geometry(config)) {
+        sim->reset(config);
+    } else {
+        /* drop the old one first, so the two are never mapped at once */
+        sim.reset();
+        sim.reset(new simulator(config));
+    }
+    sim->process_requests(trace.data(), trace.size());
+    result = format(*sim);
+}
+
+static void worker(unsigned worker_nr, std::vector<work_queue> &queues,
+                   const std::vector<trace_record> &trace,
+                   const std::vector<sim_config> &configs,
+                   const result_formatter &format,
+                   std::vector<std::string> &results) {
+    std::unique_ptr<simulator> sim;
+    size_t job;
+    while (true) {
+        bool found = queues[worker_nr].take(job);
+        /* nothing of our own left, look for work at the others */
+        for (size_t other = 1; !found && other < queues.size(); other++) {
+            found = queues[(worker_nr + other) % queues.size()].steal(job);
+        }
+        /* no queue ever grows again, so once all are empty we are done */
+        if (!found) return;
+
+        run_config(sim, trace, configs[job], format, results[job]);
+    }
+}
+
+/* shard_feed:
+ * The records of one shard, from the decoding thread to the shard's.
+ */
+class shard_feed {
+    static constexpr size_t RING_SIZE = 8;
+
+    struct batch {
+        size_t n_of_records; // = 0 marks the end of the trace
+        trace_record records[trace_source::BATCH_SIZE];
+    };
+
+    std::unique_ptr<spsc_ring<batch, RING_SIZE>> ring;
+    batch *filling; // = the batch being dealt to, not published yet
+
+  private:
+    void publish() {
+        ring->end_push();
+        filling = nullptr;
+    }
+
+    void start_batch() {
+        while (!(filling = ring->begin_push()))
+            std::this_thread::yield();
+        filling->n_of_records = 0;
+    }
+
+  public:
+    shard_feed() : ring(new spsc_ring<batch, RING_SIZE>()), filling(nullptr) {}
+
+    /* decoding side */
+    void deal(const trace_record &record) {
+        if (!filling) start_batch();
+        filling->records[filling->n_of_records++] = record;
+        if (filling->n_of_records == trace_source::BATCH_SIZE) publish();
+    }
+
+    void finish() {
+        if (filling) publish();
+        start_batch();
+        publish();
+    }
+
+    /* shard side */
+    void replay_all(simulator &sim) {
+        while (true) {
+            batch *ready;
+            while (!(ready = ring->front()))
+                std::this_thread::yield();
+            if (ready->n_of_records == 0) return;
+            sim.process_requests(ready->records, ready->n_of_records);
+            ring->pop();
+        }
+    }
+};
+
+// ---------------------------- SWEEPS ----------------------------  //
+
+bool replay_one_pass(trace_source &source, const simulator_list &sims) {
+    std::vector<trace_record> batch(trace_source::BATCH_SIZE);
+    size_t n_of_records;
+    while ((n_of_records = source.next_batch(batch.data(), batch.size())) > 0) {
+        for (size_t sim_nr = 0; sim_nr < sims.size(); sim_nr++) {
+            sims[sim_nr]->process_requests(batch.data(), n_of_records);
+        }
+    }
+    return !source.bad_format();
+}
+
+bool read_whole_trace(trace_source &source, std::vector<trace_record> &trace) {
+    size_t n_of_records;
+    do {
+        size_t old_size = trace.size();
+        trace.resize(old_size + trace_source::BATCH_SIZE);
+        n_of_records =
+            source.next_batch(&trace[old_size], trace_source::BATCH_SIZE);
+        trace.resize(old_size + n_of_records);
+    } while (n_of_records > 0);
+    return !source.bad_format();
+}
+
+void replay_parallel(const std::vector<trace_record> &trace,
+                     const std::vector<sim_config> &configs,
+                     unsigned n_of_threads, const result_formatter &format,
+                     std::vector<std::string> &results) {
+    results.assign(configs.size(), std::string());
+    if (n_of_threads > configs.size()) n_of_threads = configs.size();
+    if (n_of_threads <= 1) {
+        std::unique_ptr<simulator> sim;
+        for (size_t job = 0; job < configs.size(); job++) {
+            run_config(sim, trace, configs[job], format, results[job]);
+        }
+        return;
+    }
+
+    /* deal the configurations in runs of the same geometry, so a thread
+     * mostly resets its simulator for the next one */
+    std::vector<std::string> geometries;
+    std::vector<size_t> order;
+    for (size_t job = 0; job < configs.size(); job++) {
+        geometries.push_back(describe_geometry(configs[job]));
+        order.push_back(job);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return geometries[a] < geometries[b];
+    });
+    std::vector<work_queue> queues(n_of_threads);
+    for (size_t i = 0; i < order.size(); i++) {
+        queues[i * n_of_threads / order.size()].push(order[i]);
+    }
+
+    std::vector<std::thread> workers;
+    for (unsigned worker_nr = 0; worker_nr < n_of_threads; worker_nr++) {
+        workers.emplace_back(worker, worker_nr, std::ref(queues),
+                             std::cref(trace), std::cref(configs),
+                             std::cref(format), std::ref(results));
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+bool replay_sharded(trace_source &source, const simulator_list &shards,
+                    int block_size, int shard_bits) {
+    std::vector<shard_feed> feeds(shards.size());
+    std::vector<std::thread> workers;
+    for (size_t shard_nr = 0; shard_nr < shards.size(); shard_nr++) {
+        workers.emplace_back(&shard_feed::replay_all, &feeds[shard_nr],
+                             std::ref(*shards[shard_nr]));
+    }
+
+    addr_t shard_mask = (1u << shard_bits) - 1;
+    addr_t offset_mask = (1u << block_size) - 1;
+    std::vector<trace_record> batch(trace_source::BATCH_SIZE);
+    size_t n_of_records;
+    while ((n_of_records = source.next_batch(batch.data(), batch.size())) > 0) {
+        for (size_t i = 0; i < n_of_records; i++) {
+            trace_record record = batch[i];
+            addr_t shard_nr = (record.address >> block_size) & shard_mask;
+            record.address =
+                (record.address >> (block_size + shard_bits) << block_size) |
+                (record.address & offset_mask);
+            feeds[shard_nr].deal(record);
+        }
+    }
+
+    /* the shards stop at the end marker even if the trace is malformed */
+    for (size_t shard_nr = 0; shard_nr < feeds.size(); shard_nr++) {
+        feeds[shard_nr].finish();
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    return !source.bad_format();
+}
@@ -0,0 +1,56 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "trace.h"
+
+typedef std::vector<std::unique_ptr<simulator>> simulator_list;
+/* the results of a simulator that ran the whole trace, as they are printed */
+typedef std::function<std::string(const simulator &)> result_formatter;
+
+/* replay_one_pass:
+ * Decode the trace once and feed every batch to every simulator in turn, on
+ * the calling thread. Return false if the trace is malformed.
+ */
+bool replay_one_pass(trace_source &source, const simulator_list &sims);
+
+/* read_whole_trace:
+ * Decode the whole trace into memory, to be replayed many times. Return
+ * false if the trace is malformed.
+ */
+bool read_whole_trace(trace_source &source, std::vector<trace_record> &trace);
+
+/* replay_parallel:
+ * Replay a decoded trace through every configuration on n_of_threads
+ * threads, and keep the formatted results of each, in configuration order.
+ * The trace is only read, so all the threads share it. Each thread starts
+ * with its share of the configurations, dealt in runs of the same geometry
+ * (see describe_geometry), and runs them one after the other over the whole
+ * trace. A thread keeps the simulator of its last configuration, and resets
+ * it for the next one of the same geometry instead of building another one.
+ * A thread that runs out steals the configurations not yet started from the
+ * back of the others' queues, so a few slow high associativity ones don't
+ * hold up the rest. Every configuration ends the same as if it ran alone.
+ */
+void replay_parallel(const std::vector<trace_record> &trace,
+                     const std::vector<sim_config> &configs,
+                     unsigned n_of_threads, const result_formatter &format,
+                     std::vector<std::string> &results);
+
+/* replay_sharded:
+ * Replay the trace through the 2^shard_bits shards of one configuration,
+ * each on a thread of its own. The calling thread decodes the trace and
+ * deals every record to the shard its low shard_bits set index bits pick,
+ * with those bits taken out of the address, through a ring per shard. Each
+ * shard sees its records in trace order, so once merged they count the same
+ * as a single simulator. Return false if the trace is malformed.
+ */
+bool replay_sharded(trace_source &source, const simulator_list &shards,
+                    int block_size, int shard_bits);
+
+#endif
@@ -0,0 +1,66 @@
+#include "tag_match.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+/* keep only the bits of the first n tags */
+static uint64_t lanes_mask(int n_of_tags) {
+    return n_of_tags >= 64 ? ~0ULL : ((1ULL << n_of_tags) - 1);
+}
+
+static uint64_t match_scalar(const uint32_t *tags, int n_of_tags,
+                             uint32_t tag) {
+    uint64_t hits = 0;
+    for (int i = 0; i < n_of_tags; i++) {
+        hits |= (uint64_t)(tags[i] == tag) << i;
+    }
+    return hits;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+static uint64_t match_sse2(const uint32_t *tags, int n_of_tags, uint32_t tag) {
+    __m128i probe = _mm_set1_epi32((int)tag);
+    uint64_t hits = 0;
+    for (int i = 0; i < n_of_tags; i += 4) {
+        __m128i line =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(tags + i));
+        __m128i equal = _mm_cmpeq_epi32(line, probe);
+        uint64_t bits = (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(equal));
+        hits |= bits << i;
+    }
+    return hits & lanes_mask(n_of_tags);
+}
+
+__attribute__((target("avx2"))) static uint64_t
+match_avx2(const uint32_t *tags, int n_of_tags, uint32_t tag) {
+    __m256i probe = _mm256_set1_epi32((int)tag);
+    uint64_t hits = 0;
+    for (int i = 0; i < n_of_tags; i += 8) {
+        __m256i line =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags + i));
+        __m256i equal = _mm256_cmpeq_epi32(line, probe);
+        uint64_t bits =
+            (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(equal));
+        hits |= bits << i;
+    }
+    return hits & lanes_mask(n_of_tags);
+}
+
+#endif
+
+static match_fn detect_tag_match() {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return match_avx2;
+    if (__builtin_cpu_supports("sse2")) return match_sse2;
+#endif
+    return match_scalar;
+}
+
+match_fn select_tag_match() {
+    static match_fn selected = detect_tag_match();
+    return selected;
+}
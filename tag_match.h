@@ -0,0 +1,25 @@
+#ifndef TAG_MATCH_H
+#define TAG_MATCH_H
+
+#include <cstdint>
+
+/* Number of tags the widest kernel compares at once. The tag store pads the
+ * tags of every set to a multiple of this, so the kernels may always load
+ * whole vectors.
+ */
+static constexpr int TAG_MATCH_LANES = 8;
+
+/* match_fn:
+ * Compare the probed tag against the first n_of_tags (at most 64) tags and
+ * return a hit mask, where bit i is set if tags[i] == tag.
+ */
+typedef uint64_t (*match_fn)(const uint32_t *tags, int n_of_tags,
+                             uint32_t tag);
+
+/* select_tag_match:
+ * Pick the widest kernel the host supports (AVX2, SSE2 or plain scalar).
+ * The choice is made once, on the first call.
+ */
+match_fn select_tag_match();
+
+#endif
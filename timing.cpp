@@ -0,0 +1,122 @@
+#include "timing.h"
+
+#include <algorithm>
+
+timing_model::timing_model(int _issue_width,
+                           const std::vector<int> &_level_cycles,
+                           const std::vector<int> &n_of_mshrs, int n_of_cores)
+    : issue_width(_issue_width), level_cycles(_level_cycles),
+      n_of_l1_mshrs(n_of_mshrs[0]), cores(n_of_cores, core_cursor()) {
+    for (size_t level_nr = 0; level_nr < n_of_mshrs.size(); level_nr++) {
+        /* every core has an L1 of its own */
+        size_t n_of_copies = level_nr == 0 ? n_of_cores : 1;
+        mshrs.push_back(
+            std::vector<mshr>(n_of_copies * n_of_mshrs[level_nr], mshr()));
+    }
+}
+
+void timing_model::core_mshrs(size_t level_nr, int core_nr, size_t &first,
+                              size_t &last) const {
+    if (level_nr > 0) {
+        first = 0;
+        last = mshrs[level_nr].size();
+        return;
+    }
+    first = core_nr * n_of_l1_mshrs;
+    last = first + n_of_l1_mshrs;
+}
+
+timing_model::mshr &timing_model::first_free(size_t level_nr, int core_nr) {
+    std::vector<mshr> &level = mshrs[level_nr];
+    size_t first, last;
+    core_mshrs(level_nr, core_nr, first, last);
+    for (size_t i = first + 1; i < last; i++) {
+        if (level[i].ready < level[first].ready) first = i;
+    }
+    return level[first];
+}
+
+timing_model::mshr *timing_model::in_flight(size_t level_nr, int core_nr,
+                                            addr_t block, uint64_t now) {
+    std::vector<mshr> &level = mshrs[level_nr];
+    size_t first, last;
+    core_mshrs(level_nr, core_nr, first, last);
+    for (size_t i = first; i < last; i++) {
+        if (level[i].block == block && level[i].ready > now) return &level[i];
+    }
+    return nullptr;
+}
+
+void timing_model::access(int core_nr, addr_t block, size_t n_of_misses,
+                          int below_cycles) {
+    core_cursor &cursor = cores[core_nr];
+    if (cursor.n_of_issued == issue_width) {
+        cursor.issue_cycle++;
+        cursor.n_of_issued = 0;
+    }
+
+    /* an L1 miss can't issue before an MSHR of its L1 is free for it */
+    mshr *taken[sim_config::MAX_LEVELS];
+    if (n_of_misses > 0) {
+        taken[0] = &first_free(0, core_nr);
+        if (taken[0]->ready > cursor.issue_cycle) {
+            n_of_stall_cycles += taken[0]->ready - cursor.issue_cycle;
+            cursor.issue_cycle = taken[0]->ready;
+            cursor.n_of_issued = 0;
+        }
+    }
+    cursor.n_of_issued++;
+
+    uint64_t now = cursor.issue_cycle;
+    size_t level_nr = 0;
+    for (; level_nr < level_cycles.size(); level_nr++) {
+        now += level_cycles[level_nr];
+        if (level_nr == n_of_misses) {
+            /* a hit on a block still on its way merges with its miss */
+            mshr *pending = in_flight(level_nr, core_nr, block, now);
+            if (pending) {
+                n_of_merged++;
+                now = pending->ready;
+            }
+            break;
+        }
+        if (level_nr > 0) {
+            /* below L1 the miss waits in the level for a free MSHR */
+            taken[level_nr] = &first_free(level_nr, core_nr);
+            now = std::max(now, taken[level_nr]->ready);
+        }
+    }
+
+    if (level_nr == level_cycles.size()) {
+        /* the misses below the LLC overlap with the ones before them */
+        uint64_t start = std::max(now, mem_busy_until);
+        now += below_cycles;
+        mem_miss_cycles += below_cycles;
+        if (now > start) mem_busy_cycles += now - start;
+        mem_busy_until = std::max(mem_busy_until, now);
+    }
+
+    /* the block arrives in every level that missed at once */
+    for (size_t i = 0; i < n_of_misses; i++) {
+        taken[i]->block = block;
+        taken[i]->ready = now;
+    }
+    last_ready = std::max(last_ready, now);
+}
+
+uint64_t timing_model::get_n_of_cycles() const {
+    return last_ready;
+}
+
+uint64_t timing_model::get_n_of_stall_cycles() const {
+    return n_of_stall_cycles;
+}
+
+size_t timing_model::get_n_of_merged() const {
+    return n_of_merged;
+}
+
+double timing_model::calc_mlp() const {
+    if (mem_busy_cycles == 0) return 0;
+    return (double)mem_miss_cycles / (double)mem_busy_cycles;
+}
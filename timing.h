@@ -0,0 +1,83 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <cstdint>
+#include <vector>
+
+#include "cache.h"
+
+/* timing_model:
+ * An event driven timing of the accesses the simulator already resolved,
+ * for cores that don't wait for their accesses to finish. Every core issues
+ * up to issue_width accesses per cycle, in its own trace order, and they
+ * run in parallel. A miss in a level holds one of the level's MSHRs until
+ * its block arrives. Each core has the MSHRs of its private L1 to itself,
+ * the ones of the shared levels below are one pool. An access to a block
+ * whose fill is still in flight in the same MSHRs merges with that MSHR
+ * and finishes when it does.
+ * A core stalls only when an L1 miss finds every MSHR of its L1 busy. A
+ * miss below L1 that finds its level full waits there without holding up
+ * the core.
+ * Writes that don't allocate are posted to a write buffer and take an L1
+ * access. Prefetches are not timed here.
+ */
+class timing_model {
+    struct mshr {
+        addr_t block;
+        uint64_t ready; // = the cycle the block arrives, the MSHR is free
+    };
+
+    struct core_cursor {
+        uint64_t issue_cycle;
+        int n_of_issued; // = in issue_cycle
+    };
+
+    int issue_width;
+    std::vector<int> level_cycles;
+    /* per level, the L1 ones n_of_l1_mshrs to a core, one core after the
+     * other */
+    std::vector<std::vector<mshr>> mshrs;
+    size_t n_of_l1_mshrs;
+    std::vector<core_cursor> cores;
+
+    // data for printing
+    uint64_t last_ready = 0;
+    uint64_t n_of_stall_cycles = 0; // = summed over the cores
+    size_t n_of_merged = 0;
+    uint64_t mem_busy_cycles = 0; // = with at least one miss below the LLC
+    uint64_t mem_busy_until = 0;
+    uint64_t mem_miss_cycles = 0; // = summed over the misses below the LLC
+    // ---------------
+
+    /* the MSHRs of the level the core uses, [first, last) */
+    void core_mshrs(size_t level_nr, int core_nr, size_t &first,
+                    size_t &last) const;
+    /* the MSHR of the level that frees first, and the one for the block if
+     * it is in flight at cycle now, among the ones of the core */
+    mshr &first_free(size_t level_nr, int core_nr);
+    mshr *in_flight(size_t level_nr, int core_nr, addr_t block, uint64_t now);
+
+  public:
+    /* the access cycles and number of MSHRs of every level, L1 first, the
+     * L1 ones for each of the cores */
+    timing_model(int _issue_width, const std::vector<int> &_level_cycles,
+                 const std::vector<int> &n_of_mshrs, int n_of_cores);
+
+    /* access:
+     * Time the next access of the core, to the block. It missed and filled
+     * the first n_of_misses levels, and hit in the one after them, or, if
+     * it missed them all, spent below_cycles in the victim cache and
+     * memory.
+     */
+    void access(int core_nr, addr_t block, size_t n_of_misses,
+                int below_cycles);
+
+    /* the cycle the last access finished */
+    uint64_t get_n_of_cycles() const;
+    uint64_t get_n_of_stall_cycles() const;
+    size_t get_n_of_merged() const;
+    /* average misses in flight below the LLC, while there is one */
+    double calc_mlp() const;
+};
+
+#endif
@@ -0,0 +1,355 @@
+#include "trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ---------------------------- HELPER FUNCTIONS ---------------------------- //
+
+/* the white space of the "C" locale, minus the end of line */
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* little endian helpers for the binary format */
+static uint32_t load_le32(const char *bytes) {
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(bytes);
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) |
+           ((uint32_t)b[3] << 24);
+}
+
+static uint64_t load_le64(const char *bytes) {
+    return (uint64_t)load_le32(bytes) | ((uint64_t)load_le32(bytes + 4) << 32);
+}
+
+static void store_le32(unsigned char *bytes, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static void store_le64(unsigned char *bytes, uint64_t value) {
+    store_le32(bytes, (uint32_t)value);
+    store_le32(bytes + 4, (uint32_t)(value >> 32));
+}
+
+/* value of a hex digit, or -1 if it isn't one */
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20; /* lower case */
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// ---------------------------- TRACE READER ----------------------------  //
+
+trace_reader::trace_reader(const char *path)
+    : begin(nullptr), cur(nullptr), end(nullptr), mapped_size(0),
+      stream_fd(-1), stream_eof(false), opened(false), binary(false),
+      binary_records_left(0), format_error(false) {
+
+    bool from_stdin = std::string(path) == "-";
+    int fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd == -1) return;
+
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+        if (!from_stdin) close(fd);
+        return;
+    }
+
+    if (S_ISREG(info.st_mode)) {
+        if (info.st_size > 0) {
+            void *map =
+                mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                if (!from_stdin) close(fd);
+                return;
+            }
+            madvise(map, info.st_size, MADV_SEQUENTIAL);
+            mapped_size = info.st_size;
+            begin = static_cast<const char *>(map);
+        }
+        if (!from_stdin) close(fd);
+        cur = begin;
+        end = begin + mapped_size;
+    } else {
+        /* a pipe or a terminal, read it as it comes */
+        stream_fd = fd;
+        buffer.resize(STREAM_BUFFER_SIZE);
+        begin = cur = end = buffer.data();
+        fill_at_least(BINARY_TRACE_HEADER_SIZE);
+    }
+    opened = true;
+
+    if (fill_at_least(sizeof(BINARY_TRACE_MAGIC)) &&
+        memcmp(cur, BINARY_TRACE_MAGIC, sizeof(BINARY_TRACE_MAGIC)) == 0) {
+        binary = true;
+        format_error = !open_binary();
+    }
+}
+
+trace_reader::~trace_reader() {
+    if (mapped_size) munmap(const_cast<char *>(begin), mapped_size);
+    if (stream_fd != -1 && stream_fd != STDIN_FILENO) close(stream_fd);
+}
+
+bool trace_reader::good() const {
+    return opened;
+}
+
+bool trace_reader::bad_format() const {
+    return format_error;
+}
+
+bool trace_reader::refill() {
+    if (stream_fd == -1 || stream_eof) return false;
+
+    size_t kept = end - cur;
+    memmove(buffer.data(), cur, kept);
+    /* a line longer than the whole buffer */
+    if (kept == buffer.size()) buffer.resize(2 * buffer.size());
+
+    ssize_t n_of_bytes;
+    do {
+        n_of_bytes =
+            read(stream_fd, buffer.data() + kept, buffer.size() - kept);
+    } while (n_of_bytes == -1 && errno == EINTR);
+    if (n_of_bytes <= 0) {
+        stream_eof = true;
+        n_of_bytes = 0;
+    }
+
+    begin = cur = buffer.data();
+    end = cur + kept + n_of_bytes;
+    return n_of_bytes > 0;
+}
+
+bool trace_reader::fill_at_least(size_t n_of_bytes) {
+    while ((size_t)(end - cur) < n_of_bytes && refill()) {
+    }
+    return (size_t)(end - cur) >= n_of_bytes;
+}
+
+bool trace_reader::line_ready() {
+    while (!memchr(cur, '\n', end - cur)) {
+        if (!refill()) return cur < end;
+    }
+    return true;
+}
+
+bool trace_reader::open_binary() {
+    if (!fill_at_least(BINARY_TRACE_HEADER_SIZE)) return false;
+    if (load_le32(cur + 4) != BINARY_TRACE_VERSION) return false;
+    binary_records_left = load_le64(cur + 8);
+
+    /* a mapped file has to be exactly as long as the header says, a stream
+     * is checked when it ends */
+    if (mapped_size) {
+        size_t body = mapped_size - BINARY_TRACE_HEADER_SIZE;
+        if (body % BINARY_TRACE_RECORD_SIZE != 0 ||
+            body / BINARY_TRACE_RECORD_SIZE != binary_records_left)
+            return false;
+    }
+
+    cur += BINARY_TRACE_HEADER_SIZE;
+    return true;
+}
+
+/* Same leniency as reading "operation >> address" from the line: blanks
+ * around the fields and anything after the address are ignored. The address
+ * is hex, with or without 0x.
+ */
+bool trace_reader::decode_line(trace_record &record) {
+    const char *p = cur;
+    while (p < end && is_blank(*p))
+        p++;
+    if (p == end || *p == '\n') return false;
+    /* the simulator only knows reads and writes */
+    if (*p != OP_READ && *p != OP_WRITE) return false;
+    record.op = static_cast<op_t>(*p++);
+
+    while (p < end && is_blank(*p))
+        p++;
+    if (p == end || *p == '\n') return false;
+    if (end - p >= 2 && p[0] == '0' && (p[1] | 0x20) == 'x') p += 2;
+
+    addr_t address = 0;
+    int digit;
+    while (p < end && (digit = hex_value(*p)) != -1) {
+        address = (address << 4) | digit;
+        p++;
+    }
+    record.address = address;
+
+    /* an optional core, for a multi core trace */
+    while (p < end && is_blank(*p))
+        p++;
+    int core = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        core = core * 10 + (*p - '0');
+        if (core >= MAX_TRACE_CORES) return false;
+        p++;
+    }
+    record.core = core;
+
+    /* skip the rest of the line */
+    while (p < end && *p != '\n')
+        p++;
+    cur = p < end ? p + 1 : end;
+    return true;
+}
+
+size_t trace_reader::next_binary_batch(trace_record *records,
+                                       size_t max_records) {
+    size_t n_of_records = 0;
+    while (n_of_records < max_records && binary_records_left > 0) {
+        if (!fill_at_least(BINARY_TRACE_RECORD_SIZE)) break;
+
+        /* decode everything buffered, up to what was asked for */
+        size_t n_of_ready = (end - cur) / BINARY_TRACE_RECORD_SIZE;
+        if (n_of_ready > max_records - n_of_records)
+            n_of_ready = max_records - n_of_records;
+        if (n_of_ready > binary_records_left) n_of_ready = binary_records_left;
+
+        for (size_t i = 0; i < n_of_ready; i++) {
+            const char *record = cur + i * BINARY_TRACE_RECORD_SIZE;
+            trace_record &decoded = records[n_of_records + i];
+            decoded.op = (record[0] & BINARY_TRACE_WRITE) ? OP_WRITE : OP_READ;
+            decoded.address = load_le32(record + 1);
+            decoded.core = (uint8_t)record[0] >> BINARY_TRACE_CORE_SHIFT;
+        }
+        cur += n_of_ready * BINARY_TRACE_RECORD_SIZE;
+        n_of_records += n_of_ready;
+        binary_records_left -= n_of_ready;
+    }
+
+    /* the input ended before the header said it would, or goes on after */
+    if (n_of_records == 0 && (binary_records_left > 0 || fill_at_least(1)))
+        format_error = true;
+    return n_of_records;
+}
+
+size_t trace_reader::next_batch(trace_record *records, size_t max_records) {
+    if (format_error) return 0;
+    if (binary) return next_binary_batch(records, max_records);
+
+    bool streamed = stream_fd != -1;
+    size_t n_of_records = 0;
+    while (n_of_records < max_records) {
+        if (streamed ? !line_ready() : cur == end) break;
+        if (!decode_line(records[n_of_records])) {
+            format_error = true;
+            break;
+        }
+        n_of_records++;
+    }
+    return n_of_records;
+}
+
+// ---------------------------- PIPELINED READER ----------------------------  //
+
+pipelined_reader::pipelined_reader(trace_source &_input)
+    : input(_input), ring(new spsc_ring<batch, RING_SIZE>()),
+      input_bad_format(false), finished(false), stopping(false),
+      front_offset(0) {
+    decoder = std::thread(&pipelined_reader::decode_loop, this);
+}
+
+pipelined_reader::~pipelined_reader() {
+    /* the simulation may stop before the end, don't leave the decoder
+     * waiting for room in the ring */
+    stopping.store(true, std::memory_order_relaxed);
+    decoder.join();
+}
+
+void pipelined_reader::decode_loop() {
+    while (true) {
+        batch *slot;
+        while (!(slot = ring->begin_push())) {
+            if (stopping.load(std::memory_order_relaxed)) return;
+            std::this_thread::yield();
+        }
+
+        slot->n_of_records = input.next_batch(slot->records, BATCH_SIZE);
+        if (slot->n_of_records == 0) {
+            /* published by the release of end_push, with the end marker */
+            input_bad_format = input.bad_format();
+            ring->end_push();
+            return;
+        }
+        ring->end_push();
+    }
+}
+
+size_t pipelined_reader::next_batch(trace_record *records,
+                                    size_t max_records) {
+    if (finished) return 0;
+
+    batch *slot;
+    while (!(slot = ring->front())) {
+        std::this_thread::yield();
+    }
+    if (slot->n_of_records == 0) {
+        finished = true;
+        return 0;
+    }
+
+    size_t n_of_records = slot->n_of_records - front_offset;
+    if (n_of_records > max_records) n_of_records = max_records;
+    memcpy(records, slot->records + front_offset,
+           n_of_records * sizeof(trace_record));
+
+    front_offset += n_of_records;
+    if (front_offset == slot->n_of_records) {
+        front_offset = 0;
+        ring->pop();
+    }
+    return n_of_records;
+}
+
+bool pipelined_reader::bad_format() const {
+    return input_bad_format;
+}
+
+// ---------------------------- TRACE WRITER ----------------------------  //
+
+trace_writer::trace_writer(const char *path)
+    : file(fopen(path, "wb")), n_of_records(0) {
+    /* the count is patched in by close */
+    unsigned char header[BINARY_TRACE_HEADER_SIZE] = {0};
+    memcpy(header, BINARY_TRACE_MAGIC, sizeof(BINARY_TRACE_MAGIC));
+    store_le32(header + 4, BINARY_TRACE_VERSION);
+    if (file) fwrite(header, 1, sizeof(header), file);
+}
+
+trace_writer::~trace_writer() {
+    if (file) close();
+}
+
+bool trace_writer::good() const {
+    return file && !ferror(file);
+}
+
+void trace_writer::write(const trace_record &record) {
+    unsigned char bytes[BINARY_TRACE_RECORD_SIZE];
+    bytes[0] = record.op == OP_WRITE ? BINARY_TRACE_WRITE : 0;
+    bytes[0] |= record.core << BINARY_TRACE_CORE_SHIFT;
+    store_le32(bytes + 1, record.address);
+    fwrite(bytes, 1, sizeof(bytes), file);
+    n_of_records++;
+}
+
+bool trace_writer::close() {
+    unsigned char count[8];
+    store_le64(count, n_of_records);
+    bool ok = !ferror(file) && fseek(file, 8, SEEK_SET) == 0 &&
+              fwrite(count, 1, sizeof(count), file) == sizeof(count);
+    ok = (fclose(file) == 0) && ok;
+    file = nullptr;
+    return ok;
+}
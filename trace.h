@@ -0,0 +1,179 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "cache.h"
+#include "spsc_ring.h"
+
+/* one decoded line of the trace */
+struct trace_record {
+    op_t op;
+    addr_t address;
+    uint8_t core; // = the core that made the access, 0 for a single core
+};
+
+/* the cores a trace can tell apart, as many as can be simulated */
+static constexpr int MAX_TRACE_CORES = sim_config::MAX_CORES;
+
+/* Binary traces:
+ * A fixed 16 byte header, then one fixed width record per access. All the
+ * fields are little endian.
+ *
+ *   header: "CSBT" | uint32 version | uint64 number of records
+ *   record: uint8 flags (bit 0 set for a write, bits 1-7 the core) |
+ *           uint32 address
+ */
+static constexpr char BINARY_TRACE_MAGIC[4] = {'C', 'S', 'B', 'T'};
+static constexpr uint32_t BINARY_TRACE_VERSION = 1;
+static constexpr size_t BINARY_TRACE_HEADER_SIZE = 16;
+static constexpr size_t BINARY_TRACE_RECORD_SIZE = 5;
+static constexpr uint8_t BINARY_TRACE_WRITE = 1;
+static constexpr int BINARY_TRACE_CORE_SHIFT = 1;
+
+/* trace_source:
+ * Anything the simulator can replay records from.
+ */
+class trace_source {
+  public:
+    static constexpr size_t BATCH_SIZE = 4096;
+
+    virtual ~trace_source() {}
+
+    /* next_batch:
+     * Decode up to max_records records into records and return how many were
+     * decoded. 0 means the trace is over, or that a line is malformed, which
+     * bad_format tells apart.
+     */
+    virtual size_t next_batch(trace_record *records, size_t max_records) = 0;
+
+    virtual bool bad_format() const = 0;
+};
+
+/* trace_reader:
+ * Reads a trace, either text "r|w 0x<hex address> [core]" lines, where the
+ * decimal core is optional, or the binary format above, told apart by the
+ * magic. A regular file is memory mapped and
+ * decoded in place (text with a hand written hex parser), records are handed
+ * out in batches into a buffer of the caller, so nothing is allocated per
+ * line. Anything else, like a named pipe or stdin (given as "-"), is
+ * streamed through a buffer that only grows for lines longer than it.
+ */
+class trace_reader : public trace_source {
+    static constexpr size_t STREAM_BUFFER_SIZE = 1 << 16;
+
+    const char *begin;
+    const char *cur;
+    const char *end;
+
+    size_t mapped_size; // = 0 if the input isn't mapped
+    int stream_fd;      // = -1 if the input isn't streamed
+    bool stream_eof;
+    std::vector<char> buffer;
+
+    bool opened;
+    bool binary;
+    uint64_t binary_records_left;
+    bool format_error;
+
+  private:
+    /* keep what is left at cur and read more of a streamed input behind it,
+     * false if there is nothing more to read */
+    bool refill();
+    /* make sure at least n_of_bytes are buffered at cur, if the input has
+     * them */
+    bool fill_at_least(size_t n_of_bytes);
+    /* make sure a whole line, or the last line of the input, is at cur */
+    bool line_ready();
+
+    /* check the header of a binary trace and move past it */
+    bool open_binary();
+    /* decode the line at cur into the record and move past it */
+    bool decode_line(trace_record &record);
+    size_t next_binary_batch(trace_record *records, size_t max_records);
+
+  public:
+    explicit trace_reader(const char *path);
+    ~trace_reader();
+
+    trace_reader(const trace_reader &) = delete;
+    trace_reader &operator=(const trace_reader &) = delete;
+
+    /* good:
+     * The input was opened, false if it doesn't exist or can't be read.
+     */
+    bool good() const;
+
+    size_t next_batch(trace_record *records, size_t max_records) override;
+    bool bad_format() const override;
+};
+
+/* pipelined_reader:
+ * Decodes another source on a thread of its own, a batch ahead of the
+ * simulation. Decoded batches are handed over through a lock-free single
+ * producer single consumer ring, so parsing and simulating overlap.
+ */
+class pipelined_reader : public trace_source {
+    static constexpr size_t RING_SIZE = 8;
+
+    struct batch {
+        size_t n_of_records; // = 0 marks the end of the input
+        trace_record records[BATCH_SIZE];
+    };
+
+    trace_source &input;
+    std::unique_ptr<spsc_ring<batch, RING_SIZE>> ring;
+
+    bool input_bad_format; // only read after the end marker is popped
+    bool finished;
+    std::atomic<bool> stopping;
+    std::thread decoder;
+
+    /* the partly drained batch at the front of the ring */
+    size_t front_offset;
+
+  private:
+    void decode_loop();
+
+  public:
+    explicit pipelined_reader(trace_source &_input);
+    ~pipelined_reader();
+
+    pipelined_reader(const pipelined_reader &) = delete;
+    pipelined_reader &operator=(const pipelined_reader &) = delete;
+
+    size_t next_batch(trace_record *records, size_t max_records) override;
+    bool bad_format() const override;
+};
+
+/* trace_writer:
+ * Writes a binary trace. The number of records in the header is filled in
+ * by close.
+ */
+class trace_writer {
+    FILE *file;
+    uint64_t n_of_records;
+
+  public:
+    explicit trace_writer(const char *path);
+    ~trace_writer();
+
+    trace_writer(const trace_writer &) = delete;
+    trace_writer &operator=(const trace_writer &) = delete;
+
+    bool good() const;
+    void write(const trace_record &record);
+
+    /* close:
+     * Finish the header and close the file, return false on any error.
+     */
+    bool close();
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "trace.h"
+#include <iostream>
+
+using std::cerr;
+using std::endl;
+
+/* traceConv:
+ * Convert a text trace to the binary format of trace.h, which cacheSim
+ * replays straight from an mmap without parsing:
+ *
+ *   ./traceConv <text trace> <binary trace>
+ */
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        cerr << "Usage: " << argv[0] << " <text trace> <binary trace>"
+             << endl;
+        return 1;
+    }
+
+    trace_reader trace(argv[1]);
+    if (!trace.good()) {
+        cerr << "File not found" << endl;
+        return 1;
+    }
+
+    trace_writer binary(argv[2]);
+    if (!binary.good()) {
+        cerr << "Can't create " << argv[2] << endl;
+        return 1;
+    }
+
+    std::vector<trace_record> batch(trace_reader::BATCH_SIZE);
+    size_t n_of_records;
+    while ((n_of_records = trace.next_batch(batch.data(), batch.size())) > 0) {
+        for (size_t i = 0; i < n_of_records; i++) {
+            /* the binary format only has room for reads and writes */
+            if (batch[i].op != OP_READ && batch[i].op != OP_WRITE) {
+                cerr << "Command Format error" << endl;
+                return 1;
+            }
+            binary.write(batch[i]);
+        }
+    }
+    if (trace.bad_format()) {
+        cerr << "Command Format error" << endl;
+        return 1;
+    }
+
+    if (!binary.close()) {
+        cerr << "Failed writing " << argv[2] << endl;
+        return 1;
+    }
+    return 0;
+}